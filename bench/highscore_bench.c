@@ -0,0 +1,367 @@
+//
+// Microbenchmarks of the codec and the leaderboard operations
+//      highscore_bench [--csv] [--max-size n] [--samples n] [--sample-ms ms] [--filter name]
+//      each benchmark runs on leaderboards of 10 to --max-size entries (default 1M)
+//      an operation is warmed up and calibrated first, so that a sample runs for at least --sample-ms
+//      the time per operation of all samples is reported as min, median, mean and max in ns
+//      results are written as JSON (default) or CSV to stdout, the progress to stderr
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "s/s.h"
+#include "s/time.h"
+
+#include "highscore.h"
+#include "leaderboard.h"
+
+// default options
+#define BENCH_MAX_SIZE 1000000
+#define BENCH_SAMPLES 10
+#define BENCH_SAMPLE_MS 20
+
+// max samples (--samples)
+#define BENCH_SAMPLES_MAX 1000
+
+// the unsorted sort falls back to a bubble sort, so it is only measured for small leaderboards
+#define BENCH_UNSORTED_MAX_SIZE 1000
+
+// protected functions:
+
+HighscoreEntry_s highscore_entry_decode(sStr_s entry);
+
+Highscore highscore_decode(sStr_s msg);
+
+sString *highscore_encode(Highscore self);
+
+HighscorePackEntry_s highscorepack_entry_decode(sStr_s entry);
+
+HighscorePack highscorepack_decode(sStr_s msg);
+
+sString *highscorepack_encode(HighscorePack self);
+
+
+// state of a benchmark for a single size
+typedef struct {
+    int size;
+    su64 rng;
+    int counter;
+
+    Highscore highscore;
+    Highscore unsorted;
+    HighscorePack pack;
+    sString *encoded;
+    sString *entry;
+} Bench_s;
+
+typedef struct {
+    const char *name;
+    // only runs for sizes <= max_size, 0 if the operation does not depend on the size (runs once with size 1)
+    int max_size;
+    void (*setup)(Bench_s *self);
+    void (*run)(Bench_s *self);
+} BenchCase_s;
+
+typedef struct {
+    double min_ns, median_ns, mean_ns, max_ns;
+    su64 iterations;
+    int samples;
+} BenchResult_s;
+
+// results are written into the sink, so the compiler can not remove the operations
+static volatile int bench_sink;
+
+
+// xorshift64, so all runs use the same data
+static su64 bench_rand(Bench_s *self) {
+    self->rng ^= self->rng << 13;
+    self->rng ^= self->rng >> 7;
+    self->rng ^= self->rng << 17;
+    return self->rng;
+}
+
+static HighscoreEntry_s bench_highscore_entry(Bench_s *self) {
+    char name[HIGHSCORE_NAME_BUF_SIZE];
+    snprintf(name, sizeof name, "p%07d", self->counter++);
+    return highscore_entry_new(name, (int) (bench_rand(self) % 1000000));
+}
+
+static HighscorePackEntry_s bench_pack_entry(Bench_s *self) {
+    char text[HIGHSCORE_PACK_BUF_SIZE];
+    snprintf(text, sizeof text, "pack entry %d with some level data %08x",
+             self->counter++, (unsigned) bench_rand(self));
+    return highscorepack_entry_new(text);
+}
+
+static int bench_compare_score(const void *a, const void *b) {
+    const HighscoreEntry_s *entry_a = a;
+    const HighscoreEntry_s *entry_b = b;
+    return entry_b->score - entry_a->score;
+}
+
+// sorted highscore with size unique names
+static Highscore bench_highscore_new(Bench_s *self) {
+    Highscore highscore = {0};
+    highscore.entries = s_new(HighscoreEntry_s, self->size);
+    for (int i = 0; i < self->size; i++) {
+        highscore.entries[i] = bench_highscore_entry(self);
+    }
+    highscore.entries_size = self->size;
+    qsort(highscore.entries, highscore.entries_size, sizeof *highscore.entries, bench_compare_score);
+    return highscore;
+}
+
+static HighscorePack bench_pack_new(Bench_s *self) {
+    HighscorePack pack = {0};
+    pack.entries = s_new(HighscorePackEntry_s, self->size);
+    for (int i = 0; i < self->size; i++) {
+        pack.entries[i] = bench_pack_entry(self);
+    }
+    pack.entries_size = self->size;
+    return pack;
+}
+
+
+//
+// setups
+//
+
+static void setup_highscore_entry(Bench_s *self) {
+    self->entry = highscore_entry_to_string(bench_highscore_entry(self));
+}
+
+static void setup_highscore(Bench_s *self) {
+    self->highscore = bench_highscore_new(self);
+    self->encoded = highscore_encode(self->highscore);
+}
+
+static void setup_highscore_unsorted(Bench_s *self) {
+    setup_highscore(self);
+    self->unsorted = bench_highscore_new(self);
+    // fisher yates shuffle
+    for (int i = self->size - 1; i > 0; i--) {
+        int j = (int) (bench_rand(self) % (i + 1));
+        HighscoreEntry_s tmp = self->unsorted.entries[i];
+        self->unsorted.entries[i] = self->unsorted.entries[j];
+        self->unsorted.entries[j] = tmp;
+    }
+}
+
+static void setup_pack_entry(Bench_s *self) {
+    self->entry = highscorepack_entry_to_string(bench_pack_entry(self));
+}
+
+static void setup_pack(Bench_s *self) {
+    self->pack = bench_pack_new(self);
+    self->encoded = highscorepack_encode(self->pack);
+}
+
+
+//
+// operations
+//
+
+static void run_highscore_entry_decode(Bench_s *self) {
+    HighscoreEntry_s entry = highscore_entry_decode(s_string_get_str(self->entry));
+    bench_sink = entry.score;
+}
+
+static void run_highscore_decode(Bench_s *self) {
+    Highscore highscore = highscore_decode(s_string_get_str(self->encoded));
+    bench_sink = highscore.entries_size;
+    highscore_kill(&highscore);
+}
+
+static void run_highscore_encode(Bench_s *self) {
+    sString *encoded = highscore_encode(self->highscore);
+    bench_sink = (int) encoded->size;
+    s_string_kill(&encoded);
+}
+
+// a new player, truncated as in the server, so the size stays the same
+static void run_highscore_add_entry(Bench_s *self) {
+    highscore_add_entry(&self->highscore, bench_highscore_entry(self));
+    self->highscore.entries_size = s_min(self->highscore.entries_size, self->size);
+    bench_sink = self->highscore.entries_size;
+}
+
+// the common case, the highscore is already sorted
+static void run_highscore_sort(Bench_s *self) {
+    highscore_sort(&self->highscore);
+    bench_sink = self->highscore.entries_size;
+}
+
+// contains copying the unsorted entries into the highscore
+static void run_highscore_sort_unsorted(Bench_s *self) {
+    memcpy(self->highscore.entries, self->unsorted.entries, self->size * sizeof *self->highscore.entries);
+    highscore_sort(&self->highscore);
+    bench_sink = self->highscore.entries_size;
+}
+
+static void run_highscorepack_entry_decode(Bench_s *self) {
+    HighscorePackEntry_s entry = highscorepack_entry_decode(s_string_get_str(self->entry));
+    bench_sink = entry.text[0];
+}
+
+static void run_highscorepack_decode(Bench_s *self) {
+    HighscorePack pack = highscorepack_decode(s_string_get_str(self->encoded));
+    bench_sink = pack.entries_size;
+    highscorepack_kill(&pack);
+}
+
+static void run_highscorepack_encode(Bench_s *self) {
+    sString *encoded = highscorepack_encode(self->pack);
+    bench_sink = (int) encoded->size;
+    s_string_kill(&encoded);
+}
+
+// truncated to the size, so smaller rings stay small
+static void run_highscorepack_add_entry(Bench_s *self) {
+    highscorepack_add_entry(&self->pack, bench_pack_entry(self));
+    self->pack.entries_size = s_min(self->pack.entries_size, self->size);
+    bench_sink = self->pack.entries_size;
+}
+
+
+static const BenchCase_s bench_cases[] = {
+        {"highscore_entry_decode", 0, setup_highscore_entry, run_highscore_entry_decode},
+        {"highscore_decode", INT32_MAX, setup_highscore, run_highscore_decode},
+        {"highscore_encode", INT32_MAX, setup_highscore, run_highscore_encode},
+        {"highscore_add_entry", INT32_MAX, setup_highscore, run_highscore_add_entry},
+        {"highscore_sort", INT32_MAX, setup_highscore, run_highscore_sort},
+        {"highscore_sort_unsorted", BENCH_UNSORTED_MAX_SIZE, setup_highscore_unsorted, run_highscore_sort_unsorted},
+        {"highscorepack_entry_decode", 0, setup_pack_entry, run_highscorepack_entry_decode},
+        {"highscorepack_decode", INT32_MAX, setup_pack, run_highscorepack_decode},
+        {"highscorepack_encode", INT32_MAX, setup_pack, run_highscorepack_encode},
+        {"highscorepack_add_entry", HIGHSCORE_PACK_MAX_ENTRIES, setup_pack, run_highscorepack_add_entry},
+};
+
+static const int bench_sizes[] = {10, 100, 1000, 10000, 100000, 1000000};
+
+
+static void bench_kill(Bench_s *self) {
+    highscore_kill(&self->highscore);
+    highscore_kill(&self->unsorted);
+    highscorepack_kill(&self->pack);
+    s_string_kill(&self->encoded);
+    s_string_kill(&self->entry);
+}
+
+static int bench_compare_double(const void *a, const void *b) {
+    double da = *(const double *) a, db = *(const double *) b;
+    return (da > db) - (da < db);
+}
+
+// returns the time in seconds of n runs
+static double bench_batch(const BenchCase_s *c, Bench_s *state, su64 n) {
+    double start = s_time_monotonic();
+    for (su64 i = 0; i < n; i++) {
+        c->run(state);
+    }
+    return s_time_monotonic() - start;
+}
+
+static BenchResult_s bench_run(const BenchCase_s *c, int size, int samples, double sample_time) {
+    Bench_s state = {.size = size, .rng = 0x9E3779B97F4A7C15ull};
+    c->setup(&state);
+
+    // warmup and calibration, doubles the runs per sample until a batch takes sample_time
+    su64 n = 1;
+    while (bench_batch(c, &state, n) < sample_time)
+        n *= 2;
+
+    double ns[BENCH_SAMPLES_MAX];
+    double sum = 0;
+    for (int i = 0; i < samples; i++) {
+        ns[i] = bench_batch(c, &state, n) * 1e9 / (double) n;
+        sum += ns[i];
+    }
+    bench_kill(&state);
+
+    qsort(ns, samples, sizeof *ns, bench_compare_double);
+    return (BenchResult_s) {
+            .min_ns = ns[0],
+            .median_ns = samples % 2 ? ns[samples / 2] : (ns[samples / 2 - 1] + ns[samples / 2]) / 2,
+            .mean_ns = sum / samples,
+            .max_ns = ns[samples - 1],
+            .iterations = n * samples,
+            .samples = samples
+    };
+}
+
+static void bench_print(bool csv, bool first, const char *name, int size, BenchResult_s r) {
+    if (csv) {
+        printf("%s,%i,%llu,%i,%.1f,%.1f,%.1f,%.1f\n", name, size, (unsigned long long) r.iterations, r.samples,
+               r.min_ns, r.median_ns, r.mean_ns, r.max_ns);
+    } else {
+        printf("%s\n    {\"name\": \"%s\", \"size\": %i, \"iterations\": %llu, \"samples\": %i, "
+               "\"min_ns\": %.1f, \"median_ns\": %.1f, \"mean_ns\": %.1f, \"max_ns\": %.1f}",
+               first ? "" : ",", name, size, (unsigned long long) r.iterations, r.samples,
+               r.min_ns, r.median_ns, r.mean_ns, r.max_ns);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    bool csv = false;
+    int max_size = BENCH_MAX_SIZE;
+    int samples = BENCH_SAMPLES;
+    double sample_ms = BENCH_SAMPLE_MS;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (strcmp(argv[i], "--max-size") == 0 && has_value) {
+            max_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--samples") == 0 && has_value) {
+            // s_clamp evaluates its argument several times
+            int value = atoi(argv[++i]);
+            samples = s_clamp(value, 1, BENCH_SAMPLES_MAX);
+        } else if (strcmp(argv[i], "--sample-ms") == 0 && has_value) {
+            sample_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--csv] [--max-size n] [--samples n] [--sample-ms ms] [--filter name]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // highscore_sort logs each unsorted highscore
+    s_log_set_min_level(S_LOG_WARN);
+
+    if (csv)
+        printf("name,size,iterations,samples,min_ns,median_ns,mean_ns,max_ns\n");
+    else
+        printf("{\"benchmarks\": [");
+
+    bool first = true;
+    for (int c = 0; c < (int) (sizeof bench_cases / sizeof *bench_cases); c++) {
+        const BenchCase_s *bench = &bench_cases[c];
+        if (filter && !strstr(bench->name, filter))
+            continue;
+
+        for (int s = 0; s < (int) (sizeof bench_sizes / sizeof *bench_sizes); s++) {
+            int size = bench->max_size > 0 ? bench_sizes[s] : 1;
+            if (size > max_size || (bench->max_size > 0 && size > bench->max_size))
+                break;
+
+            fprintf(stderr, "%s (%i)...\n", bench->name, size);
+            BenchResult_s result = bench_run(bench, size, samples, sample_ms / 1000.0);
+            bench_print(csv, first, bench->name, size, result);
+            first = false;
+
+            if (bench->max_size == 0)
+                break;
+        }
+    }
+
+    if (!csv)
+        printf("\n]}\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,586 @@
+//
+// HTTP load generator for end to end benchmarks of a running highscoreserver
+//      highscore_loadgen [--host a] [--port p] [--unix path] [--rate r] [--duration s] [--connections n] [--topics n]
+//                        [--zipf s] [--get f] [--pack f] [--prefix p] [--seed] [--json]
+//      open loop: each connection sends its requests at poisson distributed arrival times,
+//      independent of the responses (rate / connections requests per second each)
+//      the latency is measured from the scheduled arrival time,
+//      so a slow server also counts the time a request had to wait for its connection (no coordinated omission)
+//      the topics are picked with a zipf distribution (topic 0 is the most popular)
+//      the mix is set by --get (fraction of GETs, the rest are POSTs) and --pack (fraction of pack topics)
+//      POSTs send valid entries (checksums of highscore_entry_to_string),
+//      so the server must be built with the same HIGHSCORE_SECRET_KEY
+//      and without an ip rate limit (RATELIMIT_IP_PER_SEC=0, the default), else most POSTs are rejected with 429
+//      --seed posts an entry to each topic before the run, so the GETs do not miss
+//      --unix connects to the unix domain socket of the server (SERVER_UNIX_SOCKET) instead of host:port
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "s/s.h"
+#include "s/socket.h"
+#include "s/time.h"
+
+#include "highscore.h"
+
+#define TYPE double
+#define CLASS Latencies
+#define FN_NAME latencies
+
+#include "s/dynarray.h"
+
+// receive buffer of a connection, must hold the headers of a response
+#define LOADGEN_BUFFER_SIZE (64 * 1024)
+
+// request buffer of a connection
+#define LOADGEN_REQUEST_SIZE 1024
+
+// send and receive timeout of a connection
+#define LOADGEN_TIMEOUT_MS 5000
+
+// wait time after a failed connect
+#define LOADGEN_RECONNECT_WAIT_S 0.1
+
+// players per connection, the names of the posted highscore entries
+#define LOADGEN_PLAYERS 1000
+
+#define LOADGEN_MAX_CONNECTIONS 1024
+
+enum loadgen_kind {
+    LOADGEN_GET_HIGHSCORE,
+    LOADGEN_GET_PACK,
+    LOADGEN_POST_HIGHSCORE,
+    LOADGEN_POST_PACK,
+    LOADGEN_KINDS
+};
+
+static const char *kind_names[LOADGEN_KINDS] = {"get_highscore", "get_pack", "post_highscore", "post_pack"};
+
+typedef struct {
+    su64 ok;            // 2xx
+    su64 rejected;      // 429 rate limited
+    su64 shed;          // 503 writer queue full
+    su64 http_errors;   // other status codes
+    su64 failed;        // connection or protocol errors (also a closed connection without a response)
+    su64 bytes;         // received bytes
+} Counters_s;
+
+typedef struct {
+    int id;
+    su64 rng;
+    sSocket *so;
+
+    char buf[LOADGEN_BUFFER_SIZE];
+    ssize pos, size;
+    su64 received;
+
+    Counters_s counters[LOADGEN_KINDS];
+    Latencies latencies[LOADGEN_KINDS];
+    double late_max;    // max delay of a send after its scheduled time
+} Worker_s;
+
+static struct {
+    const char *host;
+    int port;
+    const char *unix_path;     // NULL for tcp
+    double rate;
+    double duration;
+    int connections;
+    int topics;
+    double zipf;
+    double get;
+    double pack;
+    const char *prefix;
+    bool seed;
+    bool json;
+
+    // cumulative zipf distribution of the topics
+    double *zipf_cdf;
+
+    double start;
+} L;
+
+
+// xorshift64
+static su64 loadgen_rand(Worker_s *self) {
+    self->rng ^= self->rng << 13;
+    self->rng ^= self->rng >> 7;
+    self->rng ^= self->rng << 17;
+    return self->rng;
+}
+
+// uniform in (0, 1]
+static double loadgen_rand_unit(Worker_s *self) {
+    return (double) ((loadgen_rand(self) >> 11) + 1) / (double) (1ull << 53);
+}
+
+static void zipf_init() {
+    L.zipf_cdf = s_new(double, L.topics);
+    double sum = 0;
+    for (int i = 0; i < L.topics; i++) {
+        sum += 1.0 / pow(i + 1, L.zipf);
+        L.zipf_cdf[i] = sum;
+    }
+    for (int i = 0; i < L.topics; i++) {
+        L.zipf_cdf[i] /= sum;
+    }
+}
+
+// returns the index of a topic, distributed by zipf_cdf (binary search)
+static int zipf_topic(Worker_s *self) {
+    double u = loadgen_rand_unit(self);
+    int lo = 0, hi = L.topics - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (L.zipf_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void sleep_until(double time) {
+    double wait = time - s_time_monotonic();
+    if (wait <= 0)
+        return;
+    struct timespec ts = {(time_t) wait, (long) ((wait - (time_t) wait) * 1e9)};
+    nanosleep(&ts, NULL);
+}
+
+
+//
+// http
+//
+
+static bool worker_connect(Worker_s *self) {
+    if (s_socket_valid(self->so))
+        return true;
+    s_socket_kill(&self->so);
+    self->so = L.unix_path ? s_socket_new_unix(L.unix_path) : s_socket_new(L.host, L.port);
+    if (!s_socket_valid(self->so))
+        return false;
+    s_socket_set_timeout(self->so, LOADGEN_TIMEOUT_MS);
+    self->pos = self->size = 0;
+    return true;
+}
+
+static void worker_disconnect(Worker_s *self) {
+    s_socket_kill(&self->so);
+    self->pos = self->size = 0;
+}
+
+// receives more data into the buffer, returns false on error
+static bool worker_fill(Worker_s *self) {
+    if (self->pos > 0) {
+        memmove(self->buf, self->buf + self->pos, self->size - self->pos);
+        self->size -= self->pos;
+        self->pos = 0;
+    }
+    if (self->size >= LOADGEN_BUFFER_SIZE)
+        return false;
+    ssize n = s_stream_read_try(s_socket_get_stream(self->so), self->buf + self->size,
+                                LOADGEN_BUFFER_SIZE - self->size);
+    if (n <= 0)
+        return false;
+    self->size += n;
+    self->received += n;
+    return true;
+}
+
+// returns the offset of delim after pos, receives until delim is in the buffer
+// returns -1 on error
+static ssize worker_find(Worker_s *self, const char *delim) {
+    ssize delim_size = (ssize) strlen(delim);
+    for (;;) {
+        for (ssize i = self->pos; i + delim_size <= self->size; i++) {
+            if (memcmp(self->buf + i, delim, delim_size) == 0)
+                return i - self->pos;
+        }
+        if (!worker_fill(self))
+            return -1;
+    }
+}
+
+// consumes n bytes of the body, returns false on error
+static bool worker_skip(Worker_s *self, ssize n) {
+    while (n > 0) {
+        if (self->pos >= self->size && !worker_fill(self))
+            return false;
+        ssize take = s_min(n, self->size - self->pos);
+        self->pos += take;
+        n -= take;
+    }
+    return true;
+}
+
+// returns true if the header (lower case, with colon) has the value (case insensitive)
+static bool header_has(const char *headers, const char *name, const char *value) {
+    const char *h = strcasestr(headers, name);
+    if (!h)
+        return false;
+    h += strlen(name);
+    const char *end = strstr(h, "\r\n");
+    const char *found = strcasestr(h, value);
+    return found && (!end || found < end);
+}
+
+// reads a complete response, returns its status code or -1 on error
+static int worker_read_response(Worker_s *self) {
+    ssize header_size = worker_find(self, "\r\n\r\n");
+    if (header_size < 0)
+        return -1;
+
+    char headers[LOADGEN_BUFFER_SIZE + 1];
+    memcpy(headers, self->buf + self->pos, header_size);
+    headers[header_size] = '\0';
+    self->pos += header_size + 4;
+
+    int status;
+    if (sscanf(headers, "HTTP/%*d.%*d %d", &status) != 1)
+        return -1;
+
+    bool close = header_has(headers, "\r\nconnection:", "close");
+
+    if (header_has(headers, "\r\ntransfer-encoding:", "chunked")) {
+        for (;;) {
+            ssize line = worker_find(self, "\r\n");
+            if (line < 0)
+                return -1;
+            long chunk = strtol(self->buf + self->pos, NULL, 16);
+            self->pos += line + 2;
+            if (chunk <= 0)
+                break;
+            if (!worker_skip(self, chunk + 2))
+                return -1;
+        }
+        // trailers until the empty line
+        for (;;) {
+            ssize line = worker_find(self, "\r\n");
+            if (line < 0)
+                return -1;
+            self->pos += line + 2;
+            if (line == 0)
+                break;
+        }
+    } else {
+        const char *length = strcasestr(headers, "\r\ncontent-length:");
+        if (length && !worker_skip(self, atol(length + strlen("\r\ncontent-length:"))))
+            return -1;
+    }
+
+    if (close)
+        worker_disconnect(self);
+    return status;
+}
+
+// sends a request and reads its response
+// returns the status code or -1 on error
+static int worker_request(Worker_s *self, enum loadgen_kind kind, int topic) {
+    bool is_pack = kind == LOADGEN_GET_PACK || kind == LOADGEN_POST_PACK;
+    bool is_post = kind == LOADGEN_POST_HIGHSCORE || kind == LOADGEN_POST_PACK;
+
+    sString *entry = s_string_new_invalid();
+    if (kind == LOADGEN_POST_HIGHSCORE) {
+        char name[HIGHSCORE_NAME_BUF_SIZE];
+        snprintf(name, sizeof name, "lg%i_%i", self->id, (int) (loadgen_rand(self) % LOADGEN_PLAYERS));
+        entry = highscore_entry_to_string(highscore_entry_new(name, (int) (loadgen_rand(self) % 1000000)));
+    } else if (kind == LOADGEN_POST_PACK) {
+        char text[HIGHSCORE_PACK_BUF_SIZE];
+        snprintf(text, sizeof text, "loadgen %i level %08x", self->id, (unsigned) loadgen_rand(self));
+        entry = highscorepack_entry_to_string(highscorepack_entry_new(text));
+    }
+
+    char request[LOADGEN_REQUEST_SIZE];
+    int size = snprintf(request, sizeof request, "%s /api/%s%s/%i HTTP/1.1\r\nHost: %s\r\n",
+                        is_post ? "POST" : "GET", is_pack ? "pack/" : "", L.prefix, topic, L.host);
+    if (is_post) {
+        size += snprintf(request + size, sizeof request - size,
+                         "Content-Type: text/plain\r\nContent-Length: %i\r\n\r\n%s",
+                         (int) entry->size, entry->data);
+    } else {
+        size += snprintf(request + size, sizeof request - size, "\r\n");
+    }
+    s_string_kill(&entry);
+
+    if (size >= (int) sizeof request)
+        return -1;
+
+    if (!worker_connect(self))
+        return -1;
+    su64 received = self->received;
+    if (s_stream_write(s_socket_get_stream(self->so), request, size) != size) {
+        worker_disconnect(self);
+        return -1;
+    }
+    int status = worker_read_response(self);
+    if (status < 0) {
+        worker_disconnect(self);
+        return -1;
+    }
+    self->counters[kind].bytes += self->received - received;
+    return status;
+}
+
+static enum loadgen_kind worker_pick_kind(Worker_s *self) {
+    bool get = loadgen_rand_unit(self) <= L.get;
+    bool pack = loadgen_rand_unit(self) <= L.pack;
+    if (get)
+        return pack ? LOADGEN_GET_PACK : LOADGEN_GET_HIGHSCORE;
+    return pack ? LOADGEN_POST_PACK : LOADGEN_POST_HIGHSCORE;
+}
+
+static void worker_count(Worker_s *self, enum loadgen_kind kind, int status, double latency) {
+    Counters_s *c = &self->counters[kind];
+    if (status < 0) {
+        c->failed++;
+        return;
+    }
+    if (status >= 200 && status < 300) {
+        c->ok++;
+        latencies_push(&self->latencies[kind], latency);
+    } else if (status == 429) {
+        c->rejected++;
+    } else if (status == 503) {
+        c->shed++;
+    } else {
+        c->http_errors++;
+    }
+}
+
+static void *worker_run(void *arg) {
+    Worker_s *self = arg;
+    double rate = L.rate / L.connections;
+    double end = L.start + L.duration;
+
+    // the connections start at random offsets, so they do not send in sync
+    double next = L.start - log(loadgen_rand_unit(self)) / rate;
+    while (next < end) {
+        sleep_until(next);
+        self->late_max = s_max(self->late_max, s_time_monotonic() - next);
+
+        enum loadgen_kind kind = worker_pick_kind(self);
+        int status = worker_request(self, kind, zipf_topic(self));
+        worker_count(self, kind, status, s_time_monotonic() - next);
+
+        if (status < 0 && !s_socket_valid(self->so))
+            sleep_until(s_time_monotonic() + LOADGEN_RECONNECT_WAIT_S);
+
+        // exponential inter arrival times (poisson process)
+        next -= log(loadgen_rand_unit(self)) / rate;
+    }
+    return NULL;
+}
+
+
+//
+// report
+//
+
+static int compare_double(const void *a, const void *b) {
+    double da = *(const double *) a, db = *(const double *) b;
+    return (da > db) - (da < db);
+}
+
+static double percentile(const double *sorted, ssize n, double p) {
+    if (n <= 0)
+        return 0;
+    ssize idx = (ssize) ceil(p / 100.0 * n) - 1;
+    return sorted[s_clamp(idx, 0, n - 1)];
+}
+
+typedef struct {
+    const char *name;
+    Counters_s counters;
+    Latencies latencies;
+} Report_s;
+
+static void report_print(Report_s *reports, int n, double elapsed, double late_max) {
+    static const double ps[] = {50, 90, 99, 99.9};
+    if (L.json) {
+        printf("{\"rate\": %.1f, \"duration\": %.3f, \"connections\": %i, \"late_max_ms\": %.3f, \"results\": [",
+               L.rate, elapsed, L.connections, late_max * 1000);
+    } else {
+        printf("target rate %.1f/s, %.3f s, %i connections, max send delay %.3f ms\n",
+               L.rate, elapsed, L.connections, late_max * 1000);
+        printf("%-16s %10s %10s %8s %8s %8s %8s %10s %10s %10s %10s %10s\n",
+               "kind", "req/s", "ok", "429", "503", "http_err", "failed",
+               "p50_ms", "p90_ms", "p99_ms", "p99.9_ms", "max_ms");
+    }
+    for (int i = 0; i < n; i++) {
+        Report_s *r = &reports[i];
+        Counters_s *c = &r->counters;
+        qsort(r->latencies.array, r->latencies.size, sizeof *r->latencies.array, compare_double);
+        double p[4];
+        for (int j = 0; j < 4; j++)
+            p[j] = percentile(r->latencies.array, r->latencies.size, ps[j]) * 1000;
+        double max = r->latencies.size > 0 ? r->latencies.array[r->latencies.size - 1] * 1000 : 0;
+        su64 total = c->ok + c->rejected + c->shed + c->http_errors + c->failed;
+        if (L.json) {
+            printf("%s\n    {\"kind\": \"%s\", \"requests_per_sec\": %.1f, \"ok\": %llu, \"rejected\": %llu, "
+                   "\"shed\": %llu, \"http_errors\": %llu, \"failed\": %llu, \"bytes\": %llu, "
+                   "\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"p999_ms\": %.3f, \"max_ms\": %.3f}",
+                   i == 0 ? "" : ",", r->name, total / elapsed,
+                   (unsigned long long) c->ok, (unsigned long long) c->rejected, (unsigned long long) c->shed,
+                   (unsigned long long) c->http_errors, (unsigned long long) c->failed,
+                   (unsigned long long) c->bytes, p[0], p[1], p[2], p[3], max);
+        } else {
+            printf("%-16s %10.1f %10llu %8llu %8llu %8llu %8llu %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                   r->name, total / elapsed,
+                   (unsigned long long) c->ok, (unsigned long long) c->rejected, (unsigned long long) c->shed,
+                   (unsigned long long) c->http_errors, (unsigned long long) c->failed,
+                   p[0], p[1], p[2], p[3], max);
+        }
+    }
+    if (L.json)
+        printf("\n]}\n");
+}
+
+static void report(Worker_s *workers, double elapsed) {
+    Report_s reports[LOADGEN_KINDS + 1] = {0};
+    double late_max = 0;
+    for (int k = 0; k <= LOADGEN_KINDS; k++) {
+        reports[k].name = k < LOADGEN_KINDS ? kind_names[k] : "total";
+        reports[k].latencies = latencies_new(1024);
+    }
+    for (int w = 0; w < L.connections; w++) {
+        late_max = s_max(late_max, workers[w].late_max);
+        for (int k = 0; k < LOADGEN_KINDS; k++) {
+            Counters_s *c = &workers[w].counters[k];
+            for (int t = 0; t < 2; t++) {
+                Report_s *r = &reports[t == 0 ? k : LOADGEN_KINDS];
+                r->counters.ok += c->ok;
+                r->counters.rejected += c->rejected;
+                r->counters.shed += c->shed;
+                r->counters.http_errors += c->http_errors;
+                r->counters.failed += c->failed;
+                r->counters.bytes += c->bytes;
+                Latencies *l = &workers[w].latencies[k];
+                for (ssize i = 0; i < l->size; i++)
+                    latencies_push(&r->latencies, l->array[i]);
+            }
+        }
+    }
+    report_print(reports, LOADGEN_KINDS + 1, elapsed, late_max);
+    for (int k = 0; k <= LOADGEN_KINDS; k++)
+        latencies_kill(&reports[k].latencies);
+}
+
+
+// posts an entry to each topic (closed loop), so the GETs of the run find their topics
+static void seed_topics() {
+    Worker_s *self = s_new0(Worker_s, 1);
+    self->rng = 0x9E3779B97F4A7C15ull;
+    int failed = 0;
+    for (int i = 0; i < L.topics; i++) {
+        if (L.pack < 1 && worker_request(self, LOADGEN_POST_HIGHSCORE, i) / 100 != 2)
+            failed++;
+        if (L.pack > 0 && worker_request(self, LOADGEN_POST_PACK, i) / 100 != 2)
+            failed++;
+    }
+    worker_disconnect(self);
+    s_free(self);
+    fprintf(stderr, "seeded %i topics, %i posts failed\n", L.topics, failed);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--host a] [--port p] [--unix path] [--rate r] [--duration s] [--connections n] [--topics n]\n"
+                    "       [--zipf s] [--get f] [--pack f] [--prefix p] [--seed] [--json]\n", name);
+}
+
+int main(int argc, char **argv) {
+    L.host = "127.0.0.1";
+    L.port = 10000;
+    L.rate = 1000;
+    L.duration = 10;
+    L.connections = 16;
+    L.topics = 1000;
+    L.zipf = 1.0;
+    L.get = 0.9;
+    L.pack = 0.1;
+    L.prefix = "loadgen";
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        const char *arg = argv[i];
+        if (strcmp(arg, "--seed") == 0) {
+            L.seed = true;
+        } else if (strcmp(arg, "--json") == 0) {
+            L.json = true;
+        } else if (!has_value) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        } else if (strcmp(arg, "--host") == 0) {
+            L.host = argv[++i];
+        } else if (strcmp(arg, "--port") == 0) {
+            L.port = atoi(argv[++i]);
+        } else if (strcmp(arg, "--unix") == 0) {
+            L.unix_path = argv[++i];
+        } else if (strcmp(arg, "--rate") == 0) {
+            L.rate = atof(argv[++i]);
+        } else if (strcmp(arg, "--duration") == 0) {
+            L.duration = atof(argv[++i]);
+        } else if (strcmp(arg, "--connections") == 0) {
+            L.connections = atoi(argv[++i]);
+        } else if (strcmp(arg, "--topics") == 0) {
+            L.topics = atoi(argv[++i]);
+        } else if (strcmp(arg, "--zipf") == 0) {
+            L.zipf = atof(argv[++i]);
+        } else if (strcmp(arg, "--get") == 0) {
+            L.get = atof(argv[++i]);
+        } else if (strcmp(arg, "--pack") == 0) {
+            L.pack = atof(argv[++i]);
+        } else if (strcmp(arg, "--prefix") == 0) {
+            L.prefix = argv[++i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (L.rate <= 0 || L.duration <= 0 || L.topics <= 0
+        || L.connections <= 0 || L.connections > LOADGEN_MAX_CONNECTIONS) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // failed connections are counted, not logged
+    s_log_set_min_level(S_LOG_WTF);
+    zipf_init();
+
+    if (L.seed)
+        seed_topics();
+
+    Worker_s *workers = s_new0(Worker_s, L.connections);
+    pthread_t threads[LOADGEN_MAX_CONNECTIONS];
+    L.start = s_time_monotonic();
+    for (int i = 0; i < L.connections; i++) {
+        workers[i].id = i;
+        workers[i].rng = 0x9E3779B97F4A7C15ull * (i + 1);
+        for (int k = 0; k < LOADGEN_KINDS; k++)
+            workers[i].latencies[k] = latencies_new(1024);
+        if (pthread_create(&threads[i], NULL, worker_run, &workers[i]) != 0) {
+            fprintf(stderr, "failed to create a connection thread\n");
+            return EXIT_FAILURE;
+        }
+    }
+    for (int i = 0; i < L.connections; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = s_time_monotonic() - L.start;
+
+    report(workers, elapsed);
+
+    for (int i = 0; i < L.connections; i++) {
+        worker_disconnect(&workers[i]);
+        for (int k = 0; k < LOADGEN_KINDS; k++)
+            latencies_kill(&workers[i].latencies[k]);
+    }
+    s_free(workers);
+    s_free(L.zipf_cdf);
+    return EXIT_SUCCESS;
+}
@@ -16,6 +16,9 @@
 #define HIGHSCORE_PACK_BUF_SIZE 128
 #define HIGHSCORE_PACK_MAX_ENTRY_LENGTH 256
 
+// warnings a client can trigger (invalid entries, ...) are logged at most n times per second per call site
+#define HIGHSCORE_LOG_LIMIT_PER_SEC 10
+
 typedef struct {
     char name[HIGHSCORE_NAME_BUF_SIZE];   // + null terminated
     int score;
@@ -24,7 +24,7 @@
 #define s_max(a, b) ((a)>(b)?(a):(b))
 
 #define s_sign(x) ((x) > 0 ? 1 : ((x) < 0 ? -1 : 0))
-#define s_clamp(x, min, max) (x) < (min) ? (min) : ((x) > (max) ? (max) : (x))
+#define s_clamp(x, min, max) ((x) < (min) ? (min) : ((x) > (max) ? (max) : (x)))
 #define s_step(x, edge) (x) < (edge) ? 0 : 1;
 
 
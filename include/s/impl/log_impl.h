@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <stdatomic.h>
 #include "../memory.h"
 #include "../terminalcolor.h"
 #include "../log.h"
@@ -30,7 +31,7 @@
 #endif
 
 static struct {
-    enum s_log_level level;
+    atomic_int level;   // enum s_log_level, may be changed by a signal handler
     bool quiet;
 } s_log_L;
 
@@ -104,12 +105,189 @@ static int s_log_to_str_v(char *str, ssize n,
 }
 
 
+// formats the log line with the already formatted msg
+static int s_log_to_str(char *str, ssize n,
+                          enum s_log_level level, const char *opt_file, int line, const char *opt_func,
+                          bool colored,
+                          const char *time_str,
+                          const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int size = s_log_to_str_v(str, n, level, opt_file, line, opt_func, colored, time_str, format, args);
+    va_end(args);
+    return size;
+}
+
+static void s_log_time_str(char *time_str, time_t t) {
+#ifdef S_LOG_DO_NOT_PRINT_TIME_FILE
+    time_str[0] = '\0';
+    return;
+#endif
+    struct tm lt;
+    localtime_r(&t, &lt);
+    ssize time_size = strftime(time_str, 16, "%H:%M:%S", &lt);
+    time_str[time_size] = '\0';
+}
+
+#if defined(PLATFORM_UNIX) && !defined(OPTION_SDL)
+
+#include <pthread.h>
+#include <unistd.h>
+
+// the log thread writes its buffer, if it is this full
+#define S_LOG_ASYNC_WRITE_BUFFER_SIZE (64 * 1024)
+
+// the log thread sleeps this long, if the ring buffer is empty
+#define S_LOG_ASYNC_IDLE_US 2000
+
+typedef struct {
+    // == position of the slot, if free for the producer
+    // == position + 1, if written and ready for the log thread
+    _Atomic su64 seq;
+    time_t time;
+    enum s_log_level level;
+    const char *opt_file;   // __FILE__
+    int line;
+    char func[64];
+    char msg[S_LOG_ASYNC_MAX_LENGTH];
+} s_log__entry_s;
+
+static struct {
+    atomic_bool started;
+
+    // bounded ring buffer shared by all threads, multiple producers, single consumer (the log thread)
+    s_log__entry_s *entries;
+    su64 mask;
+    _Atomic su64 head;      // next position to claim by a producer
+    su64 tail;              // next position to read, protected by lock
+
+    // the log thread and the atexit flush
+    pthread_mutex_t lock;
+
+    atomic_uint_fast64_t dropped;
+} s_log_async_L = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// returns false if the ring buffer is full
+static bool s_log__push(enum s_log_level level, const char *opt_file, int line, const char *func,
+                        const char *format, va_list vl) {
+    su64 head = atomic_load_explicit(&s_log_async_L.head, memory_order_relaxed);
+    s_log__entry_s *e;
+    for (;;) {
+        e = &s_log_async_L.entries[head & s_log_async_L.mask];
+        su64 seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        if (seq == head) {
+            if (atomic_compare_exchange_weak_explicit(&s_log_async_L.head, &head, head + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+            // head was reloaded by the failed exchange
+        } else if (seq < head) {
+            // the slot of the last round is not read yet
+            atomic_fetch_add(&s_log_async_L.dropped, 1);
+            return false;
+        } else {
+            head = atomic_load_explicit(&s_log_async_L.head, memory_order_relaxed);
+        }
+    }
+    e->time = time(NULL);
+    e->level = level;
+    e->opt_file = opt_file;
+    e->line = line;
+    snprintf(e->func, sizeof e->func, "%s", func);
+    vsnprintf(e->msg, sizeof e->msg, format, vl);
+    atomic_store_explicit(&e->seq, head + 1, memory_order_release);
+    return true;
+}
+
+static void s_log__write(const char *buf, ssize size) {
+    s_terminalcolor_start();
+    fwrite(buf, 1, size, S_LOG_DEFAULT_FILE);
+    fflush(S_LOG_DEFAULT_FILE);
+    s_terminalcolor_stop();
+}
+
+// formats and writes all ready messages of the ring buffer
+// stops at a slot that is claimed but not yet written, so the order of the messages is kept
+// returns the number of written messages
+static int s_log__flush(char *buf) {
+    ssize buf_size = 0;
+    int n = 0;
+    char time_str[16];
+    time_t last_time = -1;
+
+    pthread_mutex_lock(&s_log_async_L.lock);
+    for (;;) {
+        su64 tail = s_log_async_L.tail;
+        s_log__entry_s *e = &s_log_async_L.entries[tail & s_log_async_L.mask];
+        if (atomic_load_explicit(&e->seq, memory_order_acquire) != tail + 1)
+            break;
+        if (e->time != last_time) {
+            s_log_time_str(time_str, e->time);
+            last_time = e->time;
+        }
+        if (buf_size + S_LOG_MAX_LENGTH > S_LOG_ASYNC_WRITE_BUFFER_SIZE) {
+            s_log__write(buf, buf_size);
+            buf_size = 0;
+        }
+        buf_size += s_log_to_str(buf + buf_size, S_LOG_MAX_LENGTH,
+                                 e->level, e->opt_file, e->line, e->func, S_LOG_COLORED, time_str,
+                                 "%s", e->msg);
+        // frees the slot for the next round
+        atomic_store_explicit(&e->seq, tail + s_log_async_L.mask + 1, memory_order_release);
+        s_log_async_L.tail = tail + 1;
+        n++;
+    }
+    if (buf_size > 0)
+        s_log__write(buf, buf_size);
+    pthread_mutex_unlock(&s_log_async_L.lock);
+    return n;
+}
+
+// atexit, writes the remaining messages (for example the log before an exit(EXIT_FAILURE))
+static void s_log__flush_at_exit() {
+    char *buf = s_malloc(S_LOG_ASYNC_WRITE_BUFFER_SIZE);
+    s_log__flush(buf);
+    s_free(buf);
+}
+
+static void *s_log__thread(void *arg) {
+    char *buf = s_malloc(S_LOG_ASYNC_WRITE_BUFFER_SIZE);
+    su64 dropped_logged = 0;
+    for (;;) {
+        int written = s_log__flush(buf);
+
+        su64 dropped = atomic_load(&s_log_async_L.dropped);
+        if (dropped != dropped_logged) {
+            // the ring buffer was just drained, so this message has room
+            s_log_warn("%llu log messages dropped (total: %llu)",
+                       (unsigned long long) (dropped - dropped_logged), (unsigned long long) dropped);
+            dropped_logged = dropped;
+        }
+
+        if (written == 0)
+            usleep(S_LOG_ASYNC_IDLE_US);
+    }
+    return NULL;
+}
+
+#endif //PLATFORM_UNIX && !OPTION_SDL
+
+
 //
 // public
 //
 
 void s_log_set_min_level(enum s_log_level level) {
-    s_log_L.level = level;
+    atomic_store_explicit(&s_log_L.level, level, memory_order_relaxed);
+}
+
+enum s_log_level s_log_get_min_level() {
+    return atomic_load_explicit(&s_log_L.level, memory_order_relaxed);
+}
+
+const char *s_log_level_name(enum s_log_level level) {
+    if (level < 0 || level >= S_LOG_NUM_LEVELS)
+        return "";
+    return s_log_src_level_names_[level];
 }
 
 void s_log_set_quiet(bool set) {
@@ -117,29 +295,64 @@ void s_log_set_quiet(bool set) {
 }
 
 
-void s_log_base(enum s_log_level level, const char *opt_file, int line,
-                  const char *opt_func, const char *format, ...) {
-    if (level < s_log_L.level || s_log_L.quiet) {
-        return;
-    }
+#if defined(PLATFORM_UNIX) && !defined(OPTION_SDL)
+
+bool s_log_async_start(int ring_size) {
+    if (atomic_load(&s_log_async_L.started))
+        return true;
+    int size = 1;
+    while (size < ring_size)
+        size *= 2;
+    s_log_async_L.entries = s_malloc(size * sizeof *s_log_async_L.entries);
+    s_log_async_L.mask = size - 1;
+    for (int i = 0; i < size; i++)
+        atomic_init(&s_log_async_L.entries[i].seq, i);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, s_log__thread, NULL) != 0)
+        return false;
+    pthread_detach(thread);
+    atexit(s_log__flush_at_exit);
+    atomic_store(&s_log_async_L.started, true);
+    return true;
+}
+
+su64 s_log_async_dropped() {
+    return atomic_load(&s_log_async_L.dropped);
+}
 
+#endif //PLATFORM_UNIX && !OPTION_SDL
+
+
+// returns true if the level should be logged
+static bool s_log__enabled(enum s_log_level level) {
+    return level >= s_log_get_min_level() && !s_log_L.quiet;
+}
+
+static void s_log__base_v(enum s_log_level level, const char *opt_file, int line,
+                          const char *opt_func, const char *format, va_list args) {
     if (!opt_func)
         opt_func = "";
 
 #ifdef S_LOG_DO_NOT_PRINT_TIME_FILE
-    char *time_str = "";
     opt_file = NULL;
+#endif
+
+#if defined(PLATFORM_UNIX) && !defined(OPTION_SDL)
+    if (level < S_LOG_WTF && atomic_load_explicit(&s_log_async_L.started, memory_order_relaxed)) {
+        s_log__push(level, opt_file, line, opt_func, format, args);
+        return;
+    }
+#endif
+
+#ifdef S_LOG_DO_NOT_PRINT_TIME_FILE
+    char *time_str = "";
 #else
     /* Get current time */
-    time_t t = time(NULL);
-    struct tm *lt = localtime(&t);
     char time_str[16];
-    ssize time_size = strftime(time_str, sizeof time_str, "%H:%M:%S", lt);
-    time_str[time_size] = '\0';
+    s_log_time_str(time_str, time(NULL));
 #endif
 
-    va_list args;
-            va_start(args, format);
     char msg[S_LOG_MAX_LENGTH];
     s_log_to_str_v(msg, sizeof msg,
                      level, opt_file, line, opt_func, S_LOG_COLORED, time_str,
@@ -155,6 +368,59 @@ void s_log_base(enum s_log_level level, const char *opt_file, int line,
 #endif //OPTION_SDL
 }
 
+static void s_log__base(enum s_log_level level, const char *opt_file, int line,
+                        const char *opt_func, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    s_log__base_v(level, opt_file, line, opt_func, format, args);
+    va_end(args);
+}
+
+// returns -1 if the message of the site should be suppressed
+// else the number of suppressed messages since the last logged one
+static int s_log__site_pass(sLogSite_s *site, int per_sec) {
+    long long now = (long long) time(NULL);
+    long long second = atomic_load_explicit(&site->second, memory_order_relaxed);
+    if (second != now && atomic_compare_exchange_strong(&site->second, &second, now))
+        atomic_store(&site->count, 0);
+
+    if (atomic_fetch_add(&site->count, 1) < per_sec)
+        return atomic_exchange(&site->suppressed, 0);
+    atomic_fetch_add(&site->suppressed, 1);
+    return -1;
+}
+
+
+void s_log_base(enum s_log_level level, const char *opt_file, int line,
+                  const char *opt_func, const char *format, ...) {
+    if (!s_log__enabled(level)) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    s_log__base_v(level, opt_file, line, opt_func, format, args);
+    va_end(args);
+}
+
+void s_log_base_limited(sLogSite_s *site, int per_sec,
+                        enum s_log_level level, const char *opt_file, int line,
+                        const char *opt_func, const char *format, ...) {
+    // disabled levels are neither logged nor counted
+    if (!s_log__enabled(level)) {
+        return;
+    }
+    int suppressed = s_log__site_pass(site, per_sec);
+    if (suppressed < 0)
+        return;
+    if (suppressed > 0)
+        s_log__base(level, opt_file, line, opt_func, "%i similar messages suppressed", suppressed);
+
+    va_list args;
+    va_start(args, format);
+    s_log__base_v(level, opt_file, line, opt_func, format, args);
+    va_end(args);
+}
+
 
 #endif //S_IMPL
 #endif //S_LOG_IMPL_H
@@ -187,6 +187,9 @@ void s_socket_set_timeout(sSocket *self, int timeout_ms) {
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <errno.h>
 
 struct sSocket {
     int so;
@@ -332,8 +335,12 @@ sSocket *s_socketserver_accept(sSocketServer *self) {
         return s_socket_new_invalid();
     }
 
-    char *client_ip = inet_ntoa(((struct sockaddr_in *) &addr)->sin_addr);
-    s_log_info("s_socketserver_accept connected with: %s", client_ip);
+    if(addr.ss_family == AF_UNIX) {
+        s_log_info("s_socketserver_accept connected with a unix socket client");
+    } else {
+        char *client_ip = inet_ntoa(((struct sockaddr_in *) &addr)->sin_addr);
+        s_log_info("s_socketserver_accept connected with: %s", client_ip);
+    }
 
     return client;
 }
@@ -400,6 +407,288 @@ void s_socket_set_timeout(sSocket *self, int timeout_ms) {
 }
 
 
+//
+// Unix domain sockets
+//
+
+// returns false if path does not fit into sun_path
+static bool s__socket_unix_addr(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof addr->sun_path)
+        return false;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+sSocketServer *s_socketserver_new_unix(const char *path, int mode) {
+    struct sockaddr_un addr;
+    if(!s__socket_unix_addr(&addr, path)) {
+        s_log_error("s_socketserver_new_unix failed, path too long: %s", path);
+        s_error_set("s_socketserver_new_unix failed");
+        return s_socketserver_new_invalid();
+    }
+
+    sSocketServer *self = s_new0(sSocketServer, 1);
+    self->so = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(!s_socketserver_valid(self)) {
+        s_log_error("s_socketserver_new_unix failed to create the server socket");
+        s_error_set("s_socketserver_new_unix failed");
+        s_free(self);
+        return s_socketserver_new_invalid();
+    }
+
+    // remove a stale socket file of a previous run (bind fails with EADDRINUSE otherwise)
+    // but never a regular file, directory or symlink at a mistyped path
+    struct stat st;
+    if(lstat(path, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            s_log_error("s_socketserver_new_unix failed, not a socket file: %s", path);
+            s_error_set("s_socketserver_new_unix failed");
+            s_socketserver_kill(&self);
+            return s_socketserver_new_invalid();
+        }
+        unlink(path);
+    }
+
+    if(bind(self->so, (struct sockaddr *) &addr, sizeof addr) == -1) {
+        s_log_error("s_socketserver_new_unix failed to bind: %s", path);
+        s_error_set("s_socketserver_new_unix failed");
+        s_socketserver_kill(&self);
+        return s_socketserver_new_invalid();
+    }
+
+    // connects are refused until listen, so setting the permissions before listen leaves no window
+    // (the umask is process wide and must not be changed here, other threads may create files)
+    if(chmod(path, (mode_t) mode) == -1) {
+        s_log_error("s_socketserver_new_unix failed to set the permissions of: %s", path);
+        s_error_set("s_socketserver_new_unix failed");
+        s_socketserver_kill(&self);
+        unlink(path);
+        return s_socketserver_new_invalid();
+    }
+
+    int backlog = 128;   // queue size of incoming connections, a proxy may open many at once
+    if(listen(self->so, backlog) == -1) {
+        s_log_error("s_socketserver_new_unix failed to listen");
+        s_error_set("s_socketserver_new_unix failed");
+        s_socketserver_kill(&self);
+    }
+
+    return self;
+}
+
+int s_socketserver_get_fd(const sSocketServer *self) {
+    if(!s_socketserver_valid(self))
+        return -1;
+    return self->so;
+}
+
+sSocket *s_socket_new_unix(const char *path) {
+    struct sockaddr_un addr;
+    if(!s__socket_unix_addr(&addr, path)) {
+        s_log_error("s_socket_new_unix failed, path too long: %s", path);
+        s_error_set("s_socket_new_unix failed");
+        return s_socket_new_invalid();
+    }
+
+    sSocket *self = s_new0(sSocket, 1);
+    self->so = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(s_socket_valid(self) && connect(self->so, (struct sockaddr *) &addr, sizeof addr) == -1) {
+        s__socket_close(self);
+    }
+
+    if(!s_socket_valid(self)) {
+        s_log_error("s_socket_new_unix failed to create the connection");
+        s_error_set("s_socket_new_unix failed");
+        s_free(self);
+        return s_socket_new_invalid();
+    }
+    return self;
+}
+
+
+//
+// SocketUdp
+//
+
+struct sSocketUdp {
+    int so;
+    su64 truncated;
+};
+
+static sSocketUdp *s__socketudp_new(const char *address, su16 port, bool server) {
+    sSocketUdp *self = s_new0(sSocketUdp, 1);
+    self->so = -1;
+
+    if(!address)
+        address = "127.0.0.1";
+
+    char port_str[8];
+    snprintf(port_str, 8, "%i", port);
+
+    struct addrinfo hints = {
+            .ai_family = AF_UNSPEC,
+            .ai_socktype = SOCK_DGRAM
+    };
+
+    // find a valid address and bind or connect to it
+    {
+        struct addrinfo *servinfo;
+        int status = getaddrinfo(address, port_str, &hints, &servinfo);
+        if (status != 0) {
+            s_log_error("s_socketudp_new failed: getaddrinfo error: %s\n", gai_strerror(status));
+            s_error_set("s_socketudp_new failed");
+            s_free(self);
+            return s_socketudp_new_invalid();
+        }
+
+        for (struct addrinfo *ai = servinfo; ai != NULL; ai = ai->ai_next) {
+            self->so = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (!s_socketudp_valid(self))
+                continue;
+
+            int res = server ? bind(self->so, ai->ai_addr, (int) ai->ai_addrlen)
+                    : connect(self->so, ai->ai_addr, (int) ai->ai_addrlen);
+            if(res == -1) {
+                close(self->so);
+                self->so = -1;
+                continue;
+            }
+
+            // valid socket + bind or connect
+            break;
+        }
+        freeaddrinfo(servinfo); // free the linked-list
+    }
+
+    // no valid address found?
+    if(!s_socketudp_valid(self)) {
+        s_log_error("s_socketudp_new failed to create the socket");
+        s_error_set("s_socketudp_new failed");
+        s_free(self);
+        return s_socketudp_new_invalid();
+    }
+    return self;
+}
+
+bool s_socketudp_valid(const sSocketUdp *self) {
+    return self && self->so >= 0;
+}
+
+sSocketUdp *s_socketudp_new_server(const char *address, su16 port) {
+    return s__socketudp_new(address, port, true);
+}
+
+sSocketUdp *s_socketudp_new(const char *address, su16 port) {
+    return s__socketudp_new(address, port, false);
+}
+
+void s_socketudp_kill(sSocketUdp **self_ptr) {
+    sSocketUdp *self = *self_ptr;
+    if(s_socketudp_valid(self))
+        close(self->so);
+    s_free(self);
+    *self_ptr = NULL;
+}
+
+// returns true if the receive error only affects this call (interrupted, timeout, memory pressure)
+static bool s__socketudp_recv_error_transient(int err) {
+    return err == EINTR || err == EAGAIN || err == EWOULDBLOCK || err == ENOMEM || err == ENOBUFS
+            || err == ECONNREFUSED;
+}
+
+// removes the truncated datagrams of the batch, keeps the order of the others
+// returns the number of remaining datagrams
+static int s__socketudp_drop_truncated(sSocketUdp *self, sStr_s *buffers, const bool *truncated, int received) {
+    int kept = 0;
+    for(int i=0; i<received; i++) {
+        if(truncated[i]) {
+            self->truncated++;
+            continue;
+        }
+        // swap, so the buffer of the dropped datagram stays in the array
+        sStr_s tmp = buffers[kept];
+        buffers[kept++] = buffers[i];
+        buffers[i] = tmp;
+    }
+    return kept;
+}
+
+int s_socketudp_recv_batch(sSocketUdp *self, sStr_s *buffers, int n) {
+    if(!s_socketudp_valid(self) || n <= 0)
+        return -1;
+
+#ifdef __linux__
+    // stack arrays, so n is clamped to a sane batch size
+    n = s_min(n, 64);
+    struct mmsghdr msgs[64];
+    struct iovec iovecs[64];
+    bool truncated[64];
+    for(;;) {
+        memset(msgs, 0, n * sizeof *msgs);
+        for(int i=0; i<n; i++) {
+            iovecs[i].iov_base = buffers[i].data;
+            iovecs[i].iov_len = buffers[i].size;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // blocks for the first datagram, then takes all that are already queued
+        int received = recvmmsg(self->so, msgs, n, MSG_WAITFORONE, NULL);
+        if(received < 0) {
+            if(s__socketudp_recv_error_transient(errno))
+                continue;
+            s_log_error("s_socketudp_recv_batch failed, killing socket...");
+            close(self->so);
+            self->so = -1;
+            return -1;
+        }
+        for(int i=0; i<received; i++) {
+            buffers[i].size = (ssize) msgs[i].msg_len;
+            truncated[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+        }
+        received = s__socketudp_drop_truncated(self, buffers, truncated, received);
+        if(received > 0)
+            return received;
+    }
+#else
+    for(;;) {
+        struct iovec iov = {buffers[0].data, buffers[0].size};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+        ssize read = recvmsg(self->so, &msg, 0);
+        if(read < 0) {
+            if(s__socketudp_recv_error_transient(errno))
+                continue;
+            s_log_error("s_socketudp_recv_batch failed, killing socket...");
+            close(self->so);
+            self->so = -1;
+            return -1;
+        }
+        if(msg.msg_flags & MSG_TRUNC) {
+            self->truncated++;
+            continue;
+        }
+        buffers[0].size = read;
+        return 1;
+    }
+#endif
+}
+
+su64 s_socketudp_truncated(const sSocketUdp *self) {
+    if(!s_socketudp_valid(self))
+        return 0;
+    return self->truncated;
+}
+
+bool s_socketudp_send(sSocketUdp *self, sStr_s datagram) {
+    if(!s_socketudp_valid(self))
+        return false;
+    ssize written = send(self->so, datagram.data, datagram.size, MSG_NOSIGNAL);
+    return written == datagram.size;
+}
+
+
 #endif // PLATFORM_UNIX
 
 
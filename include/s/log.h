@@ -5,6 +5,7 @@
 // logging
 //
 
+#include <stdatomic.h>
 #include "common.h"
 #include "export.h"
 
@@ -44,12 +45,75 @@ enum s_log_level {
 #define s_log_wtf(...)   s_log_base(S_LOG_WTF, __FILE__, __LINE__, __func__, __VA_ARGS__)
 
 
+// the min level may be changed at runtime from any thread (or a signal handler)
 S_EXPORT
 void s_log_set_min_level(enum s_log_level level);
 
+S_EXPORT
+enum s_log_level s_log_get_min_level();
+
+// returns the name of the level, like "INFO"
+S_EXPORT
+const char *s_log_level_name(enum s_log_level level);
+
 S_EXPORT
 void s_log_set_quiet(bool set);
 
+
+//
+// rate limited logging
+//      each call site of s_log_limited logs at most per_sec messages per second
+//      further messages are suppressed and counted,
+//      the next logged message of the call site is preceded by the number of suppressed messages
+//      useful for logs a client can trigger (invalid requests), so the log can not be flooded
+//
+
+// state of a call site
+typedef struct {
+    atomic_llong second;
+    atomic_int count;
+    atomic_int suppressed;
+} sLogSite_s;
+
+#define s_log_limited(level, per_sec, ...) \
+do { \
+    static sLogSite_s s_log_site_; \
+    s_log_base_limited(&s_log_site_, (per_sec), (level), __FILE__, __LINE__, __func__, __VA_ARGS__); \
+} while (0)
+
+#define s_log_debug_limited(per_sec, ...) s_log_limited(S_LOG_DEBUG, per_sec, __VA_ARGS__)
+
+#define s_log_info_limited(per_sec, ...) s_log_limited(S_LOG_INFO, per_sec, __VA_ARGS__)
+
+#define s_log_warn_limited(per_sec, ...) s_log_limited(S_LOG_WARN, per_sec, __VA_ARGS__)
+
+#define s_log_error_limited(per_sec, ...) s_log_limited(S_LOG_ERROR, per_sec, __VA_ARGS__)
+
+
+//
+// asynchronous logging (only for PLATFORM_UNIX without OPTION_SDL)
+//      s_log_base only formats the message into a lock free ring buffer shared by all threads
+//      a log thread formats the time and file infos and writes all buffered messages,
+//      so the calling thread does not wait for the write
+//      if the ring buffer is full, the message is dropped and counted
+//      messages are truncated to S_LOG_ASYNC_MAX_LENGTH
+//      WTF messages are written synchronously
+//
+#if defined(PLATFORM_UNIX) && !defined(OPTION_SDL)
+
+#define S_LOG_ASYNC_MAX_LENGTH 512
+
+// starts the log thread
+// the ring buffer holds ring_size messages (rounded up to a power of 2) of all threads
+S_EXPORT
+bool s_log_async_start(int ring_size);
+
+// returns the number of messages, that were dropped cause the ring buffer was full
+S_EXPORT
+su64 s_log_async_dropped();
+
+#endif //PLATFORM_UNIX && !OPTION_SDL
+
 /**
  * Logging function.
  * If opt_file is NULL, file and line will be omitted. (Useful for helper functions (like s_assume))
@@ -59,4 +123,12 @@ S_EXPORT
 void s_log_base(enum s_log_level level, const char *opt_file, int line,
                   const char *opt_func, const char *format, ...);
 
+/**
+ * Logging function with a rate limit, see s_log_limited.
+ */
+S_EXPORT
+void s_log_base_limited(sLogSite_s *site, int per_sec,
+                        enum s_log_level level, const char *opt_file, int line,
+                        const char *opt_func, const char *format, ...);
+
 #endif //S_LOG
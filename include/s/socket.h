@@ -4,9 +4,12 @@
 
 //
 // TCP sockets
+// Unix domain sockets (only for PLATFORM_UNIX without OPTION_SDL)
+// UDP sockets (only for PLATFORM_UNIX without OPTION_SDL)
 //
 
 #include "stream.h"
+#include "str_type.h"
 
 typedef struct sSocket sSocket;
 
@@ -81,5 +84,89 @@ S_EXPORT
 sStream_i s_socket_get_stream(sSocket *self);
 
 
+
+
+//
+// Unix domain sockets (stream)
+//      only available for PLATFORM_UNIX without OPTION_SDL
+//      local connections without the tcp stack, as for a reverse proxy on the same machine
+//
+#if defined(PLATFORM_UNIX) && !defined(OPTION_SDL)
+
+// Creates a new SocketServer, listening on the unix domain socket file path
+// an existing (stale) socket file at path is removed first, any other file at path fails
+// mode sets the permissions of the socket file (like 0660), clients need write permission to connect
+S_EXPORT
+sSocketServer *s_socketserver_new_unix(const char *path, int mode);
+
+// returns the file descriptor of the listening socket, -1 if invalid
+// the SocketServer keeps owning it (for libraries that accept on a pre bound socket)
+S_EXPORT
+int s_socketserver_get_fd(const sSocketServer *self);
+
+// Creates and connects to the unix domain socket file path
+S_EXPORT
+sSocket *s_socket_new_unix(const char *path);
+
+#endif //PLATFORM_UNIX && !OPTION_SDL
+
+
+
+//
+// SocketUdp
+//      only available for PLATFORM_UNIX without OPTION_SDL
+//
+#if defined(PLATFORM_UNIX) && !defined(OPTION_SDL)
+
+typedef struct sSocketUdp sSocketUdp;
+
+// returns true if the SocketUdp is valid to use
+S_EXPORT
+bool s_socketudp_valid(const sSocketUdp *self);
+
+// returns a new invalid SocketUdp
+static sSocketUdp *s_socketudp_new_invalid() {
+    return NULL;
+}
+
+// Creates a new UDP socket, bound to address:port to receive datagrams
+// address may be "localhost" or "127.0.0.1", to only enable local datagrams
+// address may be "0.0.0.0" to enable all incoming datagrams
+// if address is NULL, "127.0.0.1" is used
+S_EXPORT
+sSocketUdp *s_socketudp_new_server(const char *address, su16 port);
+
+// Creates a new UDP socket, connected to address:port to send datagrams
+// if address is NULL, "127.0.0.1" is used
+S_EXPORT
+sSocketUdp *s_socketudp_new(const char *address, su16 port);
+
+// kills the socket and sets it invalid
+S_EXPORT
+void s_socketudp_kill(sSocketUdp **self_ptr);
+
+// Receives up to n datagrams with a single syscall (recvmmsg on linux)
+// buffers[i].size must be set to the capacity of buffers[i].data
+//      and will be set to the size of the received datagram
+// datagrams larger than the capacity are dropped and counted (see s_socketudp_truncated)
+//      the buffers may be reordered, so the received datagrams are buffers[0..returned)
+// blocks until at least one datagram is available
+// interrupts, timeouts and memory pressure are retried
+// returns the number of received datagrams
+// If an error occurs, SocketUdp will be set invalid and -1 is returned
+S_EXPORT
+int s_socketudp_recv_batch(sSocketUdp *self, sStr_s *buffers, int n);
+
+// returns the number of datagrams dropped by s_socketudp_recv_batch, cause they were larger than the buffer
+S_EXPORT
+su64 s_socketudp_truncated(const sSocketUdp *self);
+
+// Sends a single datagram, returns false on error
+// SocketUdp must be created with s_socketudp_new
+S_EXPORT
+bool s_socketudp_send(sSocketUdp *self, sStr_s datagram);
+
+#endif //PLATFORM_UNIX && !OPTION_SDL
+
 #endif //OPTION_SOCKET
 #endif //S_SOCKET_H
@@ -0,0 +1,474 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "s/s.h"
+#include "s/file.h"
+#include "s/str.h"
+#include "s/time.h"
+#include "highscore.h"
+#include "topics.h"
+#include "persist.h"
+#include "cold.h"
+#include "metrics.h"
+
+// a record in the archive file, offset 0 is the file header, so never a record
+typedef struct {
+    ssize offset;
+    ssize bytes;    // including the record header
+} ColdRef_s;
+
+// topic -> its newest record
+#define TYPE ColdRef_s
+#define CLASS ColdIndex
+#define FN_NAME cold_index
+
+#include "s/hashmap_string.h"
+
+// a topic file, that is idle
+typedef struct {
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+    struct timespec mtime;
+    ssize size;
+    ColdRef_s record;
+} ColdCandidate_s;
+
+#define TYPE ColdCandidate_s
+#define CLASS ColdCandidates
+#define FN_NAME cold_candidates
+
+#include "s/dynarray.h"
+
+#define TYPE ColdRef_s
+#define CLASS ColdRefs
+#define FN_NAME cold_refs
+
+#include "s/dynarray.h"
+
+
+// buckets of the index hashmap
+#define COLD_INDEX_SIZE 65536
+
+// "HSCOLD01"
+#define COLD_FILE_MAGIC 0x31304c4f43534853ULL
+#define COLD_HEADER_SIZE 8
+#define COLD_RECORD_MAGIC 0x444c4f43    // "COLD"
+
+// followed by size bytes of the deflated (zlib) encoded topic
+typedef struct {
+    su32 magic;
+    su32 size;
+    su32 raw_size;      // size of the encoded topic
+    su32 crc;           // crc32 of the topic and the deflated data
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+} ColdRecord_s;
+
+
+static struct {
+    bool enabled;
+
+    // protects the index and the fd (which is replaced by a rewrite)
+    pthread_mutex_t lock;
+    ColdIndex index;
+    int fd;
+
+    // only used by the cold thread
+    char file[256];
+    ssize end;
+    ssize live;
+    ssize garbage;
+    int cold_after_s;
+    int scan_interval_s;
+} L = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// state of a cold pass
+static struct {
+    ColdCandidates candidates;
+    time_t idle_before;
+} pass;
+
+
+static su32 record_crc(const ColdRecord_s *r, const void *data) {
+    uLong crc = crc32(0, (const Bytef *) r->topic, sizeof r->topic);
+    return (su32) crc32(crc, (const Bytef *) data, r->size);
+}
+
+// reads and checks the record at offset, returns the deflated data or an invalid string
+static sString *record_read(int fd, ssize offset, ssize end, ColdRecord_s *out_record) {
+    ColdRecord_s *r = out_record;
+    if (offset + (ssize) sizeof *r > end
+        || pread(fd, r, sizeof *r, offset) != (ssize) sizeof *r
+        || r->magic != COLD_RECORD_MAGIC
+        || offset + (ssize) sizeof *r + r->size > end
+        || r->topic[HIGHSCORE_TOPIC_MAX_LENGTH - 1] != '\0')
+        return s_string_new_invalid();
+
+    sString *data = s_string_new(r->size);
+    if (pread(fd, data->data, r->size, offset + (ssize) sizeof *r) != (ssize) r->size
+        || record_crc(r, data->data) != r->crc) {
+        s_string_kill(&data);
+        return s_string_new_invalid();
+    }
+    data->size = r->size;
+    return data;
+}
+
+// sets the newest record of a topic, the old one becomes garbage
+static void index_set(const char *topic, ColdRef_s ref) {
+    ColdRef_s *item = cold_index_get(&L.index, topic);
+    if (item->offset > 0) {
+        L.live -= item->bytes;
+        L.garbage += item->bytes;
+    }
+    *item = ref;
+    L.live += ref.bytes;
+}
+
+// builds the index of all valid records
+// an invalid tail (a crash while appending) is truncated
+static void scan(ssize size) {
+    ssize offset = COLD_HEADER_SIZE;
+    ColdRecord_s r;
+    for (;;) {
+        sString *data = record_read(L.fd, offset, size, &r);
+        if (!s_string_valid(data))
+            break;
+        s_string_kill(&data);
+        ssize bytes = (ssize) sizeof r + r.size;
+        index_set(r.topic, (ColdRef_s) {offset, bytes});
+        offset += bytes;
+    }
+    if (offset < size) {
+        s_log_warn("cold archive has an invalid tail of %zu bytes, truncated", size - offset);
+        if (ftruncate(L.fd, offset) != 0)
+            s_log_error("cold archive failed to truncate");
+    }
+    L.end = offset;
+}
+
+static void topic_file_path(const char *topic, char *file) {
+    snprintf(file, 256, "topics/%s.txt", topic);
+}
+
+// nftw callback, collects all idle topic files
+static int pass_collect(const char *path, const struct stat *sb, int type, struct FTW *ftw) {
+    if (type != FTW_F)
+        return 0;
+
+    // path is "topics/<topic>.txt", skip temp files and others
+    sStr_s file = s_strc(path);
+    if (!s_str_begins_with(file, s_strc("topics/")) || !s_str_ends_with(file, s_strc(".txt")))
+        return 0;
+    sStr_s topic = {file.data + 7, file.size - 7 - 4};
+    if (topic.size <= 0 || topic.size >= HIGHSCORE_TOPIC_MAX_LENGTH)
+        return 0;
+
+    // with relatime, the access time is only updated about once a day
+    if (s_max(sb->st_mtime, sb->st_atime) >= pass.idle_before)
+        return 0;
+
+    ColdCandidate_s c = {.mtime = sb->st_mtim, .size = sb->st_size};
+    s_str_as_c(c.topic, topic);
+    cold_candidates_push(&pass.candidates, c);
+    return 0;
+}
+
+// appends the topic file as record to the archive
+static bool append(ColdCandidate_s *c) {
+    char file[256];
+    topic_file_path(c->topic, file);
+    sString *msg = s_file_read(file, true);
+    if (!s_string_valid(msg))
+        return false;
+
+    uLong bound = compressBound((uLong) msg->size);
+    char *buf = s_malloc(sizeof(ColdRecord_s) + bound);
+    ColdRecord_s *r = (ColdRecord_s *) buf;
+    memset(r, 0, sizeof *r);
+    snprintf(r->topic, sizeof r->topic, "%s", c->topic);
+
+    bool ok = compress2((Bytef *) (r + 1), &bound, (const Bytef *) msg->data, (uLong) msg->size,
+                        Z_BEST_COMPRESSION) == Z_OK;
+    if (ok) {
+        r->magic = COLD_RECORD_MAGIC;
+        r->size = (su32) bound;
+        r->raw_size = (su32) msg->size;
+        r->crc = record_crc(r, r + 1);
+        ssize bytes = (ssize) sizeof *r + r->size;
+        ok = pwrite(L.fd, buf, bytes, L.end) == bytes;
+        if (ok) {
+            metrics_add(METRICS_FILE_WRITE_BYTES, bytes);
+            c->record = (ColdRef_s) {L.end, bytes};
+            L.end += bytes;
+        }
+    }
+    if (!ok)
+        s_log_error("cold archive failed to append the topic: %s", c->topic);
+    s_free(buf);
+    s_string_kill(&msg);
+    return ok;
+}
+
+// topics_run_if_absent callback, called with the lock of the topics cache
+// indexes the appended record and removes the topic file, if the topic is still idle
+static bool retire(const char *topic, void *user_data) {
+    ColdCandidate_s *c = user_data;
+
+    // not written yet, or written since the topic file was appended
+    if (!persist_clean(topic))
+        return false;
+    char file[256];
+    topic_file_path(topic, file);
+    struct stat st;
+    if (stat(file, &st) != 0 || st.st_size != c->size
+        || st.st_mtim.tv_sec != c->mtime.tv_sec || st.st_mtim.tv_nsec != c->mtime.tv_nsec)
+        return false;
+
+    // indexed before the unlink, so a concurrent topics_get finds the topic in the archive
+    pthread_mutex_lock(&L.lock);
+    index_set(topic, c->record);
+    pthread_mutex_unlock(&L.lock);
+
+    if (unlink(file) != 0)
+        s_log_warn("cold archive failed to remove the topic file: %s", file);
+    return true;
+}
+
+// removes the records of restored topics (their topic file is back) from the index
+static void drop_restored() {
+    pthread_mutex_lock(&L.lock);
+    {
+        ColdIndexIter_s iter = cold_index_iter_new(&L.index);
+        ColdIndexItem_s *item = cold_index_iter_next(&iter);
+        while (item) {
+            // get the next item before the current one may be removed
+            ColdIndexItem_s *next = cold_index_iter_next(&iter);
+            char file[256];
+            topic_file_path(item->key, file);
+            if (access(file, F_OK) == 0) {
+                L.live -= item->value.bytes;
+                L.garbage += item->value.bytes;
+                cold_index_remove(&L.index, item->key);
+            }
+            item = next;
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+}
+
+// copies all indexed records into a new archive file, which replaces the old one
+static void rewrite() {
+    if (L.garbage < COLD_REWRITE_MIN_GARBAGE || L.garbage <= L.live)
+        return;
+    sTimer_s timer = s_timer_new();
+
+    char tmp[256 + 8];
+    snprintf(tmp, sizeof tmp, "%s.tmp", L.file);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        s_log_error("cold archive failed to create: %s", tmp);
+        return;
+    }
+
+    // blocks cold_read for the rewrite
+    pthread_mutex_lock(&L.lock);
+    {
+        su64 magic = COLD_FILE_MAGIC;
+        bool ok = pwrite(fd, &magic, sizeof magic, 0) == sizeof magic;
+        ssize end = COLD_HEADER_SIZE;
+        ColdRefs moved = cold_refs_new(1024);
+        char *buf = NULL;
+        ssize buf_size = 0;
+
+        ColdIndexIter_s iter = cold_index_iter_new(&L.index);
+        ColdIndexItem_s *item;
+        while (ok && (item = cold_index_iter_next(&iter))) {
+            if (item->value.bytes > buf_size) {
+                buf_size = item->value.bytes;
+                buf = s_renew(char, buf, buf_size);
+            }
+            ok = pread(L.fd, buf, item->value.bytes, item->value.offset) == item->value.bytes
+                 && pwrite(fd, buf, item->value.bytes, end) == item->value.bytes;
+            cold_refs_push(&moved, (ColdRef_s) {end, item->value.bytes});
+            end += item->value.bytes;
+        }
+        s_free(buf);
+        ok = ok && fsync(fd) == 0 && rename(tmp, L.file) == 0;
+
+        if (ok) {
+            // same iteration order, the index was not changed in the meantime
+            iter = cold_index_iter_new(&L.index);
+            for (ssize i = 0; (item = cold_index_iter_next(&iter)); i++)
+                item->value = moved.array[i];
+            close(L.fd);
+            L.fd = fd;
+            L.end = end;
+            L.live = end - COLD_HEADER_SIZE;
+            L.garbage = 0;
+        } else {
+            s_log_error("cold archive failed to rewrite");
+            close(fd);
+            unlink(tmp);
+        }
+        cold_refs_kill(&moved);
+        if (ok) {
+            s_log("cold archive rewritten: %.1f KiB in %.3f s", end / 1024.0, s_timer_elapsed(timer));
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+}
+
+// moves all idle topics into the archive
+static void cold_pass() {
+    sTimer_s timer = s_timer_new();
+
+    // idle topics in memory are dropped, so their topic files may be archived
+    int dropped = topics_evict_idle(L.cold_after_s, persist_clean);
+
+    pass.candidates = cold_candidates_new(64);
+    pass.idle_before = time(NULL) - L.cold_after_s;
+    if (nftw("topics", pass_collect, 32, FTW_PHYS) != 0) {
+        s_log_warn("cold archive failed to walk the topics directory");
+    }
+
+    // topics in memory are in use (and may be dirty)
+    int appended = 0;
+    for (ssize i = 0; i < pass.candidates.size; i++) {
+        ColdCandidate_s *c = &pass.candidates.array[i];
+        if (topics_run_if_absent(c->topic, NULL, NULL) && append(c))
+            appended++;
+    }
+
+    // the records must be durable, before the topic files are removed
+    int archived = 0;
+    ssize end = L.end;
+    if (appended > 0 && fsync(L.fd) != 0) {
+        s_log_error("cold archive failed to sync");
+        appended = 0;
+    }
+    for (ssize i = 0; i < pass.candidates.size; i++) {
+        ColdCandidate_s *c = &pass.candidates.array[i];
+        if (c->record.offset <= 0)
+            continue;
+        if (appended > 0 && topics_run_if_absent(c->topic, retire, c)) {
+            archived++;
+        } else {
+            L.garbage += c->record.bytes;
+        }
+    }
+    if (pass.candidates.size > 0 || dropped > 0) {
+        s_log("cold archive: archived %i of %i idle topics (%i dropped from memory, archive %.1f KiB) in %.3f s",
+              archived, (int) pass.candidates.size, dropped, end / 1024.0, s_timer_elapsed(timer));
+    }
+    cold_candidates_kill(&pass.candidates);
+
+    drop_restored();
+    rewrite();
+}
+
+static void *cold_thread(void *arg) {
+    for (;;) {
+        sleep(L.scan_interval_s);
+        cold_pass();
+    }
+    return NULL;
+}
+
+
+//
+// public
+//
+
+bool cold_init(const char *file, int cold_after_s, int scan_interval_s) {
+    sTimer_s timer = s_timer_new();
+    int fd = open(file, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        s_log_error("cold archive failed to open: %s", file);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        s_log_error("cold archive failed to stat: %s", file);
+        close(fd);
+        return false;
+    }
+
+    su64 magic = COLD_FILE_MAGIC;
+    if (st.st_size < COLD_HEADER_SIZE) {
+        if (pwrite(fd, &magic, sizeof magic, 0) != sizeof magic || fsync(fd) != 0) {
+            s_log_error("cold archive failed to create: %s", file);
+            close(fd);
+            return false;
+        }
+        st.st_size = COLD_HEADER_SIZE;
+    } else {
+        su64 read_magic = 0;
+        if (pread(fd, &read_magic, sizeof read_magic, 0) != sizeof read_magic || read_magic != magic) {
+            s_log_error("cold archive file invalid: %s", file);
+            close(fd);
+            return false;
+        }
+    }
+
+    snprintf(L.file, sizeof L.file, "%s", file);
+    L.fd = fd;
+    L.index = cold_index_new(COLD_INDEX_SIZE);
+    L.cold_after_s = cold_after_s;
+    L.scan_interval_s = s_max(1, scan_interval_s);
+    scan(st.st_size);
+    L.enabled = true;
+
+    int topics = 0;
+    ColdIndexIter_s iter = cold_index_iter_new(&L.index);
+    while (cold_index_iter_next(&iter))
+        topics++;
+    s_log("cold archive opened: %s with %i topics, %.1f KiB in %.3f s",
+          file, topics, L.end / 1024.0, s_timer_elapsed(timer));
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, cold_thread, NULL) != 0) {
+        s_log_error("cold_init failed to create the cold thread");
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+bool cold_enabled() {
+    return L.enabled;
+}
+
+sString *cold_read(const char *topic) {
+    sString *data = s_string_new_invalid();
+    ColdRecord_s r;
+    pthread_mutex_lock(&L.lock);
+    {
+        ColdRef_s *item = cold_index_get(&L.index, topic);
+        if (item->offset > 0) {
+            data = record_read(L.fd, item->offset, item->offset + item->bytes, &r);
+        } else {
+            // do not keep unavailable topics in the index
+            cold_index_remove(&L.index, topic);
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    if (!s_string_valid(data))
+        return data;
+
+    // inflate outside of the lock
+    sString *msg = s_string_new(r.raw_size);
+    uLongf size = r.raw_size;
+    if (uncompress((Bytef *) msg->data, &size, (const Bytef *) data->data, (uLong) data->size) != Z_OK
+        || size != r.raw_size) {
+        s_log_error("cold archive failed to inflate the topic: %s", topic);
+        s_string_kill(&msg);
+    } else {
+        msg->size = (ssize) size;
+        msg->data[msg->size] = '\0';
+    }
+    s_string_kill(&data);
+    return msg;
+}
@@ -0,0 +1,33 @@
+#ifndef HIGHSCORESERVER_COLD_H
+#define HIGHSCORESERVER_COLD_H
+
+//
+// Cold topic archive
+//      a cold thread moves idle topics into a compressed archive file and removes their topic file,
+//      so the topics directory stays small (and scans like backups or topics_preload are fast)
+//      a topic is idle, if it was not used in memory and its topic file was not modified (or accessed) for cold_after_s
+//      (idle topics are dropped from memory first, see topics_evict_idle)
+//      the first topics_get of an archived topic restores it into the topics cache
+//      and persists it as topic file again
+//      a topic file always wins over the archive, so the records of restored topics become garbage
+//      the archive is rewritten, if it is mostly garbage
+//
+
+#include "s/s.h"
+#include "s/string.h"
+
+// the archive is rewritten, if it has more garbage than live records and at least this many garbage bytes
+#define COLD_REWRITE_MIN_GARBAGE (1024 * 1024)
+
+// opens or creates the archive file and starts the cold thread
+// the topics directory is scanned every scan_interval_s for topics idle longer than cold_after_s
+bool cold_init(const char *file, int cold_after_s, int scan_interval_s);
+
+// returns true if the archive was opened
+bool cold_enabled();
+
+// returns the decompressed encoded topic, or an invalid string if the topic is not in the archive
+// topic must be 0 terminated!
+sString *cold_read(const char *topic);
+
+#endif //HIGHSCORESERVER_COLD_H
@@ -0,0 +1,355 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "s/s.h"
+#include "s/str.h"
+#include "s/time.h"
+#include "leaderboard.h"
+#include "topics.h"
+#include "journal.h"
+#include "store.h"
+#include "cold.h"
+#include "metrics.h"
+#include "engine.h"
+
+// protected functions:
+
+HighscoreEntry_s highscore_entry_decode(sStr_s entry);
+
+sString *highscore_encode(Highscore self);
+
+HighscorePackEntry_s highscorepack_entry_decode(sStr_s entry);
+
+sString *highscorepack_encode(HighscorePack self);
+
+
+static struct {
+    // entries not accepted by the full writer queue
+    atomic_uint_fast64_t admission_shed;
+} L;
+
+// returns the data of the topic with a new reference, or NULL if it is not available or of another type
+static TopicData *topic_data(const EngineTopic_s *topic, bool is_pack) {
+    if (topic->is_pack != is_pack)
+        return NULL;
+    TopicData *data = topics_get(topic->topic);
+    if (data && data->is_pack != is_pack)
+        topicdata_unref(&data);
+    return data;
+}
+
+// submits the entry, sets *opt_shed and returns true
+static bool submit(WriterEntry_s add, bool wait, bool *opt_shed) {
+    bool shed = !engine_submit(add, wait);
+    if (opt_shed)
+        *opt_shed = shed;
+    return true;
+}
+
+// applies the entries to the topic, called by the single writer thread, so no lock is needed
+// topic must be 0 terminated!
+static void save_entries(const char *topic, const HighscoreEntry_s *adds, int n) {
+    // the in memory data is immutable, so work on a copy
+    TopicData *old = topics_get(topic);
+    Highscore highscore = {0};
+    if (old) {
+        highscore.entries = s_new(HighscoreEntry_s, old->highscore.entries_size);
+        memcpy(highscore.entries, old->highscore.entries,
+               old->highscore.entries_size * sizeof *highscore.entries);
+        highscore.entries_size = old->highscore.entries_size;
+        topicdata_unref(&old);
+    }
+
+    sTimer_s timer = s_timer_new();
+    for(int i=0; i<n; i++) {
+        highscore_add_entry(&highscore, adds[i]);
+    }
+
+    if (highscore.entries_size > HIGHSCORE_MAX_ENTRIES) {
+        highscore.entries_size = HIGHSCORE_MAX_ENTRIES;
+    }
+    metrics_stage(METRICS_STAGE_INSERT, timer);
+
+    timer = s_timer_new();
+    highscore_sort(&highscore);
+    metrics_stage(METRICS_STAGE_SORT, timer);
+
+    timer = s_timer_new();
+    sString *save = highscore_encode(highscore);
+    TopicData *data = topicdata_new_highscore(highscore, s_string_get_str(save));
+    metrics_stage(METRICS_STAGE_ENCODE, timer);
+
+    // coalesced and written by persist
+    // marked dirty before it is set, so it is never evicted before it is written
+    // with the journal, the log persists the entries and the topic file is written with the next snapshot
+    if (journal_enabled())
+        s_string_kill(&save);
+    else
+        persist_add(topic, save);
+    topics_set(topic, data);
+}
+
+// applies the entries to the topic, called by the single writer thread, so no lock is needed
+// topic must be 0 terminated!
+static void save_pack_entries(const char *topic, const HighscorePackEntry_s *adds, int n) {
+    // the in memory data is immutable, so work on a copy
+    TopicData *old = topics_get(topic);
+    HighscorePack highscore = {0};
+    if (old) {
+        highscore.entries = s_new(HighscorePackEntry_s, old->pack.entries_size);
+        memcpy(highscore.entries, old->pack.entries,
+               old->pack.entries_size * sizeof *highscore.entries);
+        highscore.entries_size = old->pack.entries_size;
+        topicdata_unref(&old);
+    }
+
+    sTimer_s timer = s_timer_new();
+    for(int i=0; i<n; i++) {
+        highscorepack_add_entry(&highscore, adds[i]);
+    }
+    metrics_stage(METRICS_STAGE_INSERT, timer);
+
+    timer = s_timer_new();
+    sString *save = highscorepack_encode(highscore);
+    TopicData *data = topicdata_new_pack(highscore, s_string_get_str(save));
+    metrics_stage(METRICS_STAGE_ENCODE, timer);
+
+    // coalesced and written by persist
+    // marked dirty before it is set, so it is never evicted before it is written
+    // with the journal, the log persists the entries and the topic file is written with the next snapshot
+    if (journal_enabled())
+        s_string_kill(&save);
+    else
+        persist_add(topic, save);
+    topics_set(topic, data);
+}
+
+
+//
+// public
+//
+
+bool engine_submit(WriterEntry_s entry, bool wait) {
+    WriterDone_s done;
+    if (wait)
+        writer_done_init(&done);
+    sTimer_s timer = s_timer_new();
+
+    if (!writer_submit(entry, wait ? &done : NULL)) {
+        su64 shed = atomic_fetch_add(&L.admission_shed, 1) + 1;
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC,
+                           "writer queue full, entry shed (shed total: %llu)", (unsigned long long) shed);
+        return false;
+    }
+
+    if (wait) {
+        writer_done_wait(&done);
+        metrics_stage(METRICS_STAGE_WRITER, timer);
+        metrics_stages_merge(&done.stages);
+    }
+    return true;
+}
+
+bool engine_save_entry(sStr_s topic, sStr_s entry, bool *shed) {
+    WriterEntry_s add = {.is_pack = false};
+    sTimer_s timer = s_timer_new();
+    add.entry = highscore_entry_decode(entry);
+    metrics_stage(METRICS_STAGE_DECODE, timer);
+    if (add.entry.name[0] == '\0')
+        return false;
+
+    s_str_as_c(add.topic, topic);
+    *shed = !engine_submit(add, true);
+    return true;
+}
+
+bool engine_save_pack_entry(sStr_s topic, sStr_s entry, bool *shed) {
+    WriterEntry_s add = {.is_pack = true};
+    sTimer_s timer = s_timer_new();
+    add.pack_entry = highscorepack_entry_decode(entry);
+    metrics_stage(METRICS_STAGE_DECODE, timer);
+    if (add.pack_entry.text[0] == '\0')
+        return false;
+
+    s_str_as_c(add.topic, topic);
+    *shed = !engine_submit(add, true);
+    return true;
+}
+
+bool engine_topic_valid(sStr_s topic) {
+    if (s_str_empty(topic) || s_str_count(topic, '.') > 0) {
+        s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "topic invalid");
+        return false;
+    }
+
+    if (topic.size >= HIGHSCORE_TOPIC_MAX_LENGTH) {
+        s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "topic to large");
+        return false;
+    }
+    return true;
+}
+
+bool engine_start(const EngineConfig_s *config) {
+    if (config->store) {
+        persist_make_dirs("topics");
+        if (!store_open(config->store_file)) {
+            s_log_error("failed to open the store");
+            return false;
+        }
+    }
+
+    // the journal writes the topic files with its snapshots, so no flush thread
+    bool journal = config->journal_snapshot_interval_s > 0;
+    if (!persist_init(config->persist_sync, config->persist_sync_interval_ms,
+                      journal ? 0 : config->persist_flush_interval_ms, config->persist_flush_dirty_max)) {
+        s_log_error("failed to start the persistence");
+        return false;
+    }
+
+    if (config->memory_budget_mb > 0) {
+        if (config->journal_snapshot_interval_s > 0)
+            s_log_warn("memory budget ignored, the journal needs all topics in memory");
+        else
+            topics_set_budget((ssize) config->memory_budget_mb * 1024 * 1024, persist_clean);
+    }
+
+    if (config->cold_after_s > 0) {
+        if (config->store || config->journal_snapshot_interval_s > 0) {
+            s_log_warn("cold archive ignored, it only works on topic files");
+        } else {
+            persist_make_dirs("topics");
+            if (!cold_init(config->cold_file, config->cold_after_s, config->cold_scan_interval_s)) {
+                s_log_error("failed to open the cold archive");
+                return false;
+            }
+        }
+    }
+
+    if (config->journal_snapshot_interval_s > 0) {
+        // recovers all topics from the snapshot and the log
+        if (!journal_init(config->persist_sync, config->persist_sync_interval_ms,
+                          config->journal_snapshot_interval_s, config->journal_threads,
+                          save_entries, save_pack_entries)) {
+            s_log_error("failed to open the journal");
+            return false;
+        }
+    } else if (config->preload_threads > 0) {
+        topics_preload(config->preload_threads);
+    }
+
+    if (!writer_start(config->queue_depth, save_entries, save_pack_entries)) {
+        s_log_error("failed to start the writer");
+        return false;
+    }
+    return true;
+}
+
+su64 engine_admission_shed() {
+    return atomic_load(&L.admission_shed);
+}
+
+
+bool engine_try_submit(WriterEntry_s entry) {
+    return writer_submit(entry, NULL);
+}
+
+//
+// Embedded API
+//
+
+bool engine_topic_open(EngineTopic_s *out_topic, const char *topic) {
+    *out_topic = (EngineTopic_s) {0};
+    if (!engine_topic_valid(s_strc(topic)))
+        return false;
+    strcpy(out_topic->topic, topic);
+    out_topic->is_pack = topics_is_pack(topic);
+    return true;
+}
+
+bool engine_submit_entry(const EngineTopic_s *topic, HighscoreEntry_s entry, bool wait, bool *opt_shed) {
+    entry.name[HIGHSCORE_NAME_MAX_LENGTH] = '\0';
+    if (topic->is_pack || entry.name[0] == '\0')
+        return false;
+    WriterEntry_s add = {.is_pack = false, .entry = entry};
+    strcpy(add.topic, topic->topic);
+    return submit(add, wait, opt_shed);
+}
+
+bool engine_submit_pack_entry(const EngineTopic_s *topic, HighscorePackEntry_s entry, bool wait, bool *opt_shed) {
+    entry.text[HIGHSCORE_PACK_MAX_LENGTH] = '\0';
+    if (!topic->is_pack || entry.text[0] == '\0')
+        return false;
+    WriterEntry_s add = {.is_pack = true, .pack_entry = entry};
+    strcpy(add.topic, topic->topic);
+    return submit(add, wait, opt_shed);
+}
+
+int engine_top(const EngineTopic_s *topic, HighscoreEntry_s *out, int n) {
+    TopicData *data = topic_data(topic, false);
+    if (!data)
+        return 0;
+    n = s_min(n, data->highscore.entries_size);
+    memcpy(out, data->highscore.entries, n * sizeof *out);
+    topicdata_unref(&data);
+    return n;
+}
+
+HighscoreEntry_s *engine_top_a(const EngineTopic_s *topic, int n, int *out_size, sAllocator_i a) {
+    *out_size = 0;
+    TopicData *data = topic_data(topic, false);
+    if (!data)
+        return NULL;
+    if (n < 0 || n > data->highscore.entries_size)
+        n = data->highscore.entries_size;
+    HighscoreEntry_s *entries = NULL;
+    if (n > 0) {
+        entries = s_a_new(a, HighscoreEntry_s, n);
+        memcpy(entries, data->highscore.entries, n * sizeof *entries);
+        *out_size = n;
+    }
+    topicdata_unref(&data);
+    return entries;
+}
+
+int engine_pack_top(const EngineTopic_s *topic, HighscorePackEntry_s *out, int n) {
+    TopicData *data = topic_data(topic, true);
+    if (!data)
+        return 0;
+    n = s_min(n, data->pack.entries_size);
+    memcpy(out, data->pack.entries, n * sizeof *out);
+    topicdata_unref(&data);
+    return n;
+}
+
+HighscorePackEntry_s *engine_pack_top_a(const EngineTopic_s *topic, int n, int *out_size, sAllocator_i a) {
+    *out_size = 0;
+    TopicData *data = topic_data(topic, true);
+    if (!data)
+        return NULL;
+    if (n < 0 || n > data->pack.entries_size)
+        n = data->pack.entries_size;
+    HighscorePackEntry_s *entries = NULL;
+    if (n > 0) {
+        entries = s_a_new(a, HighscorePackEntry_s, n);
+        memcpy(entries, data->pack.entries, n * sizeof *entries);
+        *out_size = n;
+    }
+    topicdata_unref(&data);
+    return entries;
+}
+
+int engine_rank(const EngineTopic_s *topic, const char *name, HighscoreEntry_s *opt_entry) {
+    TopicData *data = topic_data(topic, false);
+    if (!data)
+        return 0;
+    int rank = 0;
+    for (int i = 0; i < data->highscore.entries_size; i++) {
+        if (strcmp(data->highscore.entries[i].name, name) == 0) {
+            rank = i + 1;
+            if (opt_entry)
+                *opt_entry = data->highscore.entries[i];
+            break;
+        }
+    }
+    topicdata_unref(&data);
+    return rank;
+}
@@ -0,0 +1,126 @@
+#ifndef HIGHSCORESERVER_ENGINE_H
+#define HIGHSCORESERVER_ENGINE_H
+
+//
+// Leaderboard engine, the core of the server without http (libhighscore)
+//      engine_start opens the storage (topic files, store, journal, cold archive),
+//      recovers the topics and starts the single writer
+//      entries are decoded and validated on the calling thread and applied by the writer (see writer.h)
+//      the http server (main.c) is a thin layer over it, so it can also be embedded into other processes
+//
+// Embedded API (engine_topic_open, engine_submit_entry, engine_top, engine_rank, ...)
+//      for game servers, that link libhighscore and call the engine in process (no socket, http or text codec)
+//      all functions are thread safe, the readers copy from the immutable topic data without holding a lock
+//      engine_top and engine_rank do not allocate (if the topic is in memory),
+//      the _a variants allocate the result with the allocator of the caller
+//      submitted entries are trusted, so they have no checksum
+//
+
+#include "s/allocator.h"
+#include "highscore.h"
+#include "persist.h"
+#include "writer.h"
+
+typedef struct {
+    // see persist.h
+    enum persist_sync persist_sync;
+    int persist_sync_interval_ms;
+    int persist_flush_interval_ms;
+    int persist_flush_dirty_max;
+
+    // true to store all topics in the single file store store_file (see store.h)
+    bool store;
+    const char *store_file;
+
+    // memory budget of the topics, 0 for unlimited (not used with the journal, see topics.h)
+    int memory_budget_mb;
+
+    // cold archive, cold_after_s 0 to disable (not used with the store or the journal, see cold.h)
+    int cold_after_s;
+    int cold_scan_interval_s;
+    const char *cold_file;
+
+    // threads to preload all topics, 0 to load the topics on first use
+    int preload_threads;
+
+    // snapshot interval of the journal, 0 to disable the journal (see journal.h)
+    int journal_snapshot_interval_s;
+    int journal_threads;
+
+    // max entries queued for the writer at once, see writer.h
+    int queue_depth;
+} EngineConfig_s;
+
+// a validated topic, see engine_topic_open
+typedef struct {
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+    bool is_pack;
+} EngineTopic_s;
+
+
+// opens the storage, recovers the topics and starts the writer (call once)
+// returns false on error (logged)
+bool engine_start(const EngineConfig_s *config);
+
+// returns false if the topic is not valid (empty, too long or contains a '.')
+bool engine_topic_valid(sStr_s topic);
+
+// submits the entry to the writer queue
+// if wait is true, waits until the writer has applied the entry
+// returns false if the queue is full, so the entry was shed
+bool engine_submit(WriterEntry_s entry, bool wait);
+
+// submits the entry to the writer queue, without waiting
+// returns false if the queue is full, which is not counted as shed (for callers that retry the entry later)
+bool engine_try_submit(WriterEntry_s entry);
+
+// topic and entry must be 0 terminated!
+// decodes the entry on the calling thread and waits until the writer applied it
+// returns false if the entry was not valid
+// *shed is set to true, if the writer queue was full
+bool engine_save_entry(sStr_s topic, sStr_s entry, bool *shed);
+
+// same as engine_save_entry for a pack topic
+bool engine_save_pack_entry(sStr_s topic, sStr_s entry, bool *shed);
+
+// returns the number of entries not accepted by the full writer queue
+su64 engine_admission_shed();
+
+
+//
+// Embedded API
+//
+
+// validates the topic (as in the http api, without /api/, pack topics start with pack/)
+// returns false if the topic is not valid
+bool engine_topic_open(EngineTopic_s *out_topic, const char *topic);
+
+// submits the entry, if wait is true, waits until the writer has applied it
+// returns false if the entry is not valid (empty or too long name) or the topic is a pack topic
+// *opt_shed is set to true, if the writer queue was full
+bool engine_submit_entry(const EngineTopic_s *topic, HighscoreEntry_s entry, bool wait, bool *opt_shed);
+
+// same as engine_submit_entry for pack topics
+bool engine_submit_pack_entry(const EngineTopic_s *topic, HighscorePackEntry_s entry, bool wait, bool *opt_shed);
+
+// copies up to n of the best entries into out
+// returns the number of copied entries (0 if the topic is not available or a pack topic)
+int engine_top(const EngineTopic_s *topic, HighscoreEntry_s *out, int n);
+
+// same as engine_top, but allocates the entries with a (s_a_free them), n < 0 for all entries
+// returns NULL if no entry was copied
+HighscoreEntry_s *engine_top_a(const EngineTopic_s *topic, int n, int *out_size, sAllocator_i a);
+
+// copies up to n of the newest entries of a pack topic into out
+// returns the number of copied entries (0 if the topic is not available or not a pack topic)
+int engine_pack_top(const EngineTopic_s *topic, HighscorePackEntry_s *out, int n);
+
+// same as engine_pack_top, but allocates the entries with a (s_a_free them), n < 0 for all entries
+// returns NULL if no entry was copied
+HighscorePackEntry_s *engine_pack_top_a(const EngineTopic_s *topic, int n, int *out_size, sAllocator_i a);
+
+// returns the rank (1 is the best) of the entry with the name, 0 if the name is not in the topic
+// if opt_entry is not NULL, it is set to the entry
+int engine_rank(const EngineTopic_s *topic, const char *name, HighscoreEntry_s *opt_entry);
+
+#endif //HIGHSCORESERVER_ENGINE_H
@@ -62,13 +62,14 @@ uint64_t highscore_entry_get_checksum(HighscoreEntry_s self) {
 
 HighscoreEntry_s highscore_entry_decode(sStr_s entry) {
     if (entry.size > HIGHSCORE_MAX_ENTRY_LENGTH - 1) {
-        s_log_warn("highscore_entry_decode failed, entry.size is to long");
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "highscore_entry_decode failed, entry.size is to long");
         return (HighscoreEntry_s) {0};
     }
     sStr_s splits[4];
     int splits_cnt = s_str_split(splits, 4, entry, '~');
     if (splits_cnt != 3) {
-        s_log_warn("highscore_entry_decode failed to parse entry, splits_cnt!=3: %i", splits_cnt);
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC,
+                           "highscore_entry_decode failed to parse entry, splits_cnt!=3: %i", splits_cnt);
         return (HighscoreEntry_s) {0};
     }
 
@@ -76,7 +77,8 @@ HighscoreEntry_s highscore_entry_decode(sStr_s entry) {
     int score = (int) strtol(splits[0].data, &end, 10);
 
     if (end != splits[1].data - 1 || splits[1].size == 0 || splits[1].size > HIGHSCORE_NAME_MAX_LENGTH) {
-        s_log_warn("highscore_entry_decode failed to parse entry, invalid score or name length");
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC,
+                           "highscore_entry_decode failed to parse entry, invalid score or name length");
         return (HighscoreEntry_s) {0};
     }
 
@@ -87,7 +89,8 @@ HighscoreEntry_s highscore_entry_decode(sStr_s entry) {
     _Static_assert(sizeof(unsigned long long) >= sizeof(uint64_t), "wrong sizes");
     uint64_t checksum = (uint64_t) strtoull(splits[2].data, NULL, 10);
     if (highscore_entry_get_checksum(self) != checksum) {
-        s_log_warn("highscore_entry_decode failed to parse entry, invalid checksum");
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC,
+                           "highscore_entry_decode failed to parse entry, invalid checksum");
         return (HighscoreEntry_s) {0};
     }
 
@@ -149,19 +152,21 @@ uint64_t highscorepack_entry_get_checksum(HighscorePackEntry_s self) {
 
 HighscorePackEntry_s highscorepack_entry_decode(sStr_s entry) {
     if (entry.size > HIGHSCORE_PACK_MAX_ENTRY_LENGTH - 1) {
-        s_log_warn("highscorepack_entry_decode failed, entry.size is to long");
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "highscorepack_entry_decode failed, entry.size is to long");
         return (HighscorePackEntry_s) {0};
     }
     sStr_s splits[3];
     int splits_cnt = s_str_split(splits, 3, entry, '~');
     if (splits_cnt != 2) {
-        s_log_warn("highscorepack_entry_decode failed to parse entry, splits_cnt!=2: %i", splits_cnt);
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC,
+                           "highscorepack_entry_decode failed to parse entry, splits_cnt!=2: %i", splits_cnt);
         return (HighscorePackEntry_s) {0};
     }
 
 
     if (splits[1].size == 0 || splits[1].size > HIGHSCORE_PACK_MAX_LENGTH) {
-        s_log_warn("highscorepack_entry_decode failed to parse entry, invalid text length");
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC,
+                           "highscorepack_entry_decode failed to parse entry, invalid text length");
         return (HighscorePackEntry_s) {0};
     }
 
@@ -171,7 +176,8 @@ HighscorePackEntry_s highscorepack_entry_decode(sStr_s entry) {
     _Static_assert(sizeof(unsigned long long) >= sizeof(uint64_t), "wrong sizes");
     uint64_t checksum = (uint64_t) strtoull(splits[0].data, NULL, 10);
     if (highscorepack_entry_get_checksum(self) != checksum) {
-        s_log_warn("highscorepack_entry_decode failed to parse entry, invalid checksum");
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC,
+                           "highscorepack_entry_decode failed to parse entry, invalid checksum");
         return (HighscorePackEntry_s) {0};
     }
 
@@ -0,0 +1,738 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "s/s.h"
+#include "s/file.h"
+#include "s/str.h"
+#include "s/string.h"
+#include "s/time.h"
+#include "topics.h"
+#include "journal.h"
+
+#define JOURNAL_SNAPSHOT_FILE JOURNAL_DIR "/snapshot.bin"
+
+// "HSSNAP02"
+#define JOURNAL_SNAPSHOT_MAGIC 0x32305041534e5348ULL
+
+// max threads for loading and replaying
+#define JOURNAL_MAX_THREADS 64
+
+// buckets of the dirty topic map
+#define JOURNAL_DIRTY_MAP_SIZE 4096
+
+// log record of an applied entry
+// followed by topic_size bytes of the topic (not terminated) and the entry of its type
+// (HighscoreEntry_s or HighscorePackEntry_s)
+typedef struct {
+    su32 crc;           // crc32 of the rest of the record, to detect a torn write at the end of a log segment
+    su8 is_pack;
+    su8 topic_size;
+    su16 reserved;      // 0
+} JournalRecord_s;
+
+typedef struct {
+    su64 magic;
+    su32 entry_size;        // sizeof(HighscoreEntry_s)
+    su32 pack_entry_size;   // sizeof(HighscorePackEntry_s)
+    su64 segment;           // first log segment, that is not contained in the snapshot
+    su64 topics;
+} JournalSnapshotHeader_s;
+
+// followed by entries_size entries (HighscoreEntry_s or HighscorePackEntry_s)
+typedef struct {
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+    su32 is_pack;
+    su32 entries_size;
+} JournalSnapshotTopic_s;
+
+// a snapshot in progress
+typedef struct {
+    TopicRef_s *refs;
+    ssize refs_size;
+    su64 segment;
+
+    // topics changed since the last snapshot, their topic files are written after the snapshot
+    TopicRef_s *dirty;
+    ssize dirty_size;
+} JournalSnapshot_s;
+
+typedef struct {
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+} JournalTopic_s;
+
+#define TYPE WriterEntry_s
+#define CLASS JournalEntries
+#define FN_NAME journal_entries
+
+#include "s/dynarray.h"
+
+#define TYPE JournalTopic_s
+#define CLASS JournalTopics
+#define FN_NAME journal_topics
+
+#include "s/dynarray.h"
+
+// dirty topic -> 1
+#define TYPE int
+#define CLASS JournalDirtyMap
+#define FN_NAME journal_dirty_map
+
+#include "s/hashmap_string.h"
+
+
+// protected functions:
+
+sString *highscore_encode(Highscore self);
+
+sString *highscorepack_encode(HighscorePack self);
+
+
+static struct {
+    bool enabled;
+    enum persist_sync sync;
+    double sync_interval;
+    double snapshot_interval;
+    int threads;
+    writer_apply_fn apply;
+    writer_apply_pack_fn apply_pack;
+
+    // only used by the writer thread
+    int fd;
+    su64 segment;
+    sString *buffer;
+    int buffer_records;
+    bool unsynced;
+    double last_sync_time;
+    double last_snapshot_time;
+
+    // topics changed since the last snapshot (writer thread only)
+    JournalTopics dirty;
+    JournalDirtyMap dirty_map;
+
+    atomic_bool snapshot_running;
+} L;
+
+// state of the recovery in journal_init
+static struct {
+    sString *snapshot;
+    ssize *offsets;
+    ssize offsets_size;
+
+    // the replayed entries, bucketed by partition:
+    // the entries of partition p are entries.array[indices[starts[p]]] ... entries.array[indices[starts[p + 1] - 1]]
+    JournalEntries entries;
+    ssize *indices;
+    ssize *starts;
+    int partitions;
+
+    atomic_int next;
+} recover;
+
+
+static bool write_all(int fd, const void *data, ssize size) {
+    const char *d = data;
+    while (size > 0) {
+        ssize n = write(fd, d, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        d += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0 || fsync(fd) != 0)
+        s_log_error("failed to sync the directory: %s", dir);
+    if (fd >= 0)
+        close(fd);
+}
+
+static ssize record_entry_size(bool is_pack) {
+    return is_pack ? (ssize) sizeof(HighscorePackEntry_s) : (ssize) sizeof(HighscoreEntry_s);
+}
+
+// marks the topic to be written with the next snapshot
+static void dirty_add(const char *topic) {
+    int *dirty = journal_dirty_map_get(&L.dirty_map, topic);
+    if (*dirty)
+        return;
+    *dirty = 1;
+    JournalTopic_s add;
+    snprintf(add.topic, sizeof add.topic, "%s", topic);
+    journal_topics_push(&L.dirty, add);
+}
+
+// returns the dirty topics with a reference of their data (unref them and s_free the array!) and clears them
+static TopicRef_s *dirty_take(ssize *out_size) {
+    TopicRef_s *refs = s_new(TopicRef_s, s_max(1, L.dirty.size));
+    ssize n = 0;
+    for (ssize i = 0; i < L.dirty.size; i++) {
+        const char *topic = L.dirty.array[i].topic;
+        TopicData *data = topics_get(topic);
+        if (data) {
+            snprintf(refs[n].topic, sizeof refs[n].topic, "%s", topic);
+            refs[n++].data = data;
+        }
+        journal_dirty_map_remove(&L.dirty_map, topic);
+    }
+    L.dirty.size = 0;
+    *out_size = n;
+    return refs;
+}
+
+// syncs the log segment
+static void log_sync() {
+    if (fdatasync(L.fd) != 0)
+        s_log_error("failed to sync the log segment");
+    L.unsynced = false;
+    L.last_sync_time = s_time_monotonic();
+}
+
+static void segment_file(char *file, su64 segment) {
+    snprintf(file, 256, JOURNAL_DIR "/log_%llu.bin", (unsigned long long) segment);
+}
+
+// returns the segment of a log segment file name or 0, if its not a log segment
+static su64 segment_of(const char *name) {
+    sStr_s s = s_strc(name);
+    if (!s_str_begins_with(s, s_strc("log_")) || !s_str_ends_with(s, s_strc(".bin")))
+        return 0;
+    return (su64) strtoull(name + 4, NULL, 10);
+}
+
+// returns the max segment of the available log segments, or 0
+static su64 segments_max() {
+    su64 max = 0;
+    DIR *dir = opendir(JOURNAL_DIR);
+    if (!dir)
+        return 0;
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        max = s_max(max, segment_of(e->d_name));
+    }
+    closedir(dir);
+    return max;
+}
+
+// removes all log segments before segment
+static void segments_remove_before(su64 segment) {
+    DIR *dir = opendir(JOURNAL_DIR);
+    if (!dir)
+        return;
+    struct dirent *e;
+    while ((e = readdir(dir))) {
+        su64 s = segment_of(e->d_name);
+        if (s > 0 && s < segment) {
+            char file[256];
+            segment_file(file, s);
+            if (remove(file) != 0)
+                s_log_warn("failed to remove the log segment: %s", file);
+        }
+    }
+    closedir(dir);
+}
+
+// switches the log to a new (empty) segment
+static bool segment_open(su64 segment) {
+    char file[256];
+    segment_file(file, segment);
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        s_log_error("failed to open the log segment: %s", file);
+        return false;
+    }
+    if (L.fd > 0) {
+        // the old segment is needed until the next snapshot is written
+        fdatasync(L.fd);
+        close(L.fd);
+    }
+    sync_dir(JOURNAL_DIR);
+    L.fd = fd;
+    L.segment = segment;
+    return true;
+}
+
+// creates the topic data of a snapshot topic or a replay
+static TopicData *topicdata_from_entries(bool is_pack, const void *entries, int entries_size) {
+    if (is_pack) {
+        HighscorePack pack = {NULL, entries_size};
+        if (entries_size > 0) {
+            pack.entries = s_new(HighscorePackEntry_s, entries_size);
+            memcpy(pack.entries, entries, entries_size * sizeof *pack.entries);
+        }
+        sString *encoded = highscorepack_encode(pack);
+        TopicData *data = topicdata_new_pack(pack, s_string_get_str(encoded));
+        s_string_kill(&encoded);
+        return data;
+    }
+    Highscore highscore = {NULL, entries_size};
+    if (entries_size > 0) {
+        highscore.entries = s_new(HighscoreEntry_s, entries_size);
+        memcpy(highscore.entries, entries, entries_size * sizeof *highscore.entries);
+    }
+    sString *encoded = highscore_encode(highscore);
+    TopicData *data = topicdata_new_highscore(highscore, s_string_get_str(encoded));
+    s_string_kill(&encoded);
+    return data;
+}
+
+// writes the snapshot into a temp file and renames it over the old snapshot
+static bool snapshot_write(const JournalSnapshot_s *snap) {
+    const char *tmp = JOURNAL_SNAPSHOT_FILE ".tmp";
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        s_log_error("failed to open the snapshot file: %s", tmp);
+        return false;
+    }
+
+    JournalSnapshotHeader_s header = {
+            .magic = JOURNAL_SNAPSHOT_MAGIC,
+            .entry_size = sizeof(HighscoreEntry_s),
+            .pack_entry_size = sizeof(HighscorePackEntry_s),
+            .segment = snap->segment,
+            .topics = snap->refs_size
+    };
+    bool ok = fwrite(&header, sizeof header, 1, f) == 1;
+
+    for (ssize i = 0; ok && i < snap->refs_size; i++) {
+        const TopicData *data = snap->refs[i].data;
+        JournalSnapshotTopic_s topic = {0};
+        snprintf(topic.topic, sizeof topic.topic, "%s", snap->refs[i].topic);
+        topic.is_pack = data->is_pack;
+        topic.entries_size = data->is_pack ? data->pack.entries_size : data->highscore.entries_size;
+        ok = fwrite(&topic, sizeof topic, 1, f) == 1;
+        if (ok && topic.entries_size > 0) {
+            if (data->is_pack)
+                ok = fwrite(data->pack.entries, sizeof(HighscorePackEntry_s), topic.entries_size, f)
+                     == topic.entries_size;
+            else
+                ok = fwrite(data->highscore.entries, sizeof(HighscoreEntry_s), topic.entries_size, f)
+                     == topic.entries_size;
+        }
+    }
+
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    fclose(f);
+    if (!ok) {
+        s_log_error("failed to write the snapshot file: %s", tmp);
+        remove(tmp);
+        return false;
+    }
+
+    if (rename(tmp, JOURNAL_SNAPSHOT_FILE) != 0) {
+        s_log_error("failed to rename the snapshot file: %s", tmp);
+        return false;
+    }
+    sync_dir(JOURNAL_DIR);
+    return true;
+}
+
+// writes the topic files of the topics changed since the last snapshot
+// the writer does not write them, the log persists the entries
+static void snapshot_materialize(const JournalSnapshot_s *snap) {
+    for (ssize i = 0; i < snap->dirty_size; i++) {
+        const TopicData *data = snap->dirty[i].data;
+        sString *encoded = data->is_pack ? highscorepack_encode(data->pack) : highscore_encode(data->highscore);
+        persist_add(snap->dirty[i].topic, encoded);
+    }
+    persist_flush();
+}
+
+static void *snapshot_thread(void *arg) {
+    JournalSnapshot_s *snap = arg;
+    sTimer_s timer = s_timer_new();
+
+    if (snapshot_write(snap)) {
+        // the log segments before are contained in the snapshot
+        segments_remove_before(snap->segment);
+        s_log("journal snapshot of %i topics written in %.3f s",
+              (int) snap->refs_size, s_timer_elapsed(timer));
+    }
+
+    snapshot_materialize(snap);
+
+    for (ssize i = 0; i < snap->refs_size; i++) {
+        topicdata_unref(&snap->refs[i].data);
+    }
+    for (ssize i = 0; i < snap->dirty_size; i++) {
+        topicdata_unref(&snap->dirty[i].data);
+    }
+    s_free(snap->refs);
+    s_free(snap->dirty);
+    s_free(snap);
+    atomic_store(&L.snapshot_running, false);
+    return NULL;
+}
+
+// starts a snapshot of the current topics, called by the writer between two batches
+// if async is false, the snapshot is written on the calling thread
+static void snapshot_start(bool async) {
+    // the new log segment only contains entries after the snapshot
+    if (!segment_open(L.segment + 1))
+        return;
+
+    JournalSnapshot_s *snap = s_new(JournalSnapshot_s, 1);
+    snap->segment = L.segment;
+    snap->refs = topics_collect(&snap->refs_size);
+    snap->dirty = dirty_take(&snap->dirty_size);
+    atomic_store(&L.snapshot_running, true);
+    L.last_snapshot_time = s_time_monotonic();
+
+    pthread_t thread;
+    if (!async || pthread_create(&thread, NULL, snapshot_thread, snap) != 0) {
+        snapshot_thread(snap);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// runs fn on threads threads, including the calling thread
+static void parallel(int threads, void *(*fn)(void *)) {
+    atomic_store(&recover.next, 0);
+    threads = s_clamp(threads, 1, JOURNAL_MAX_THREADS);
+    pthread_t ids[JOURNAL_MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&ids[started], NULL, fn, NULL) != 0)
+            break;
+        started++;
+    }
+    // the work is taken with recover.next, so the calling thread finishes it, if no thread was created
+    fn(NULL);
+    for (int i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+}
+
+static void *snapshot_load_thread(void *arg) {
+    for (;;) {
+        int i = atomic_fetch_add(&recover.next, 1);
+        if (i >= recover.offsets_size)
+            break;
+        const char *at = recover.snapshot->data + recover.offsets[i];
+        JournalSnapshotTopic_s topic;
+        memcpy(&topic, at, sizeof topic);
+        topic.topic[HIGHSCORE_TOPIC_MAX_LENGTH - 1] = '\0';
+        topics_set(topic.topic, topicdata_from_entries(topic.is_pack, at + sizeof topic, (int) topic.entries_size));
+    }
+    return NULL;
+}
+
+// loads the snapshot into the topics
+// returns the first log segment after the snapshot, or 0 if no (valid) snapshot is available
+static su64 snapshot_load() {
+    if (access(JOURNAL_SNAPSHOT_FILE, F_OK) != 0)
+        return 0;
+    recover.snapshot = s_file_read(JOURNAL_SNAPSHOT_FILE, false);
+    if (!s_string_valid(recover.snapshot))
+        return 0;
+
+    const char *data = recover.snapshot->data;
+    ssize size = recover.snapshot->size;
+    JournalSnapshotHeader_s header;
+    if (size < (ssize) sizeof header) {
+        s_log_error("journal snapshot invalid, to small");
+        s_string_kill(&recover.snapshot);
+        return 0;
+    }
+    memcpy(&header, data, sizeof header);
+    if (header.magic != JOURNAL_SNAPSHOT_MAGIC
+        || header.entry_size != sizeof(HighscoreEntry_s)
+        || header.pack_entry_size != sizeof(HighscorePackEntry_s)
+        || header.segment == 0) {
+        s_log_error("journal snapshot invalid, wrong header");
+        s_string_kill(&recover.snapshot);
+        return 0;
+    }
+
+    // index the topics, so they can be decoded in parallel
+    recover.offsets = s_new(ssize, s_max(1, header.topics));
+    recover.offsets_size = 0;
+    ssize offset = sizeof header;
+    for (su64 i = 0; i < header.topics; i++) {
+        JournalSnapshotTopic_s topic;
+        if (offset + (ssize) sizeof topic > size)
+            break;
+        memcpy(&topic, data + offset, sizeof topic);
+        ssize entry_size = topic.is_pack ? header.pack_entry_size : header.entry_size;
+        ssize next = offset + (ssize) sizeof topic + (ssize) topic.entries_size * entry_size;
+        if (next > size)
+            break;
+        recover.offsets[recover.offsets_size++] = offset;
+        offset = next;
+    }
+    if (recover.offsets_size != (ssize) header.topics) {
+        s_log_error("journal snapshot invalid, truncated");
+        s_free(recover.offsets);
+        s_string_kill(&recover.snapshot);
+        return 0;
+    }
+
+    parallel(L.threads, snapshot_load_thread);
+
+    s_free(recover.offsets);
+    s_string_kill(&recover.snapshot);
+    return header.segment;
+}
+
+// reads all valid records of the log segment into recover.entries
+// stops at the first invalid record (torn write of a crash)
+static void replay_read(su64 segment) {
+    char file[256];
+    segment_file(file, segment);
+    sString *content = s_file_read(file, false);
+    if (!s_string_valid(content))
+        return;
+
+    const char *data = content->data;
+    ssize size = content->size;
+    for (ssize pos = 0; pos < size;) {
+        JournalRecord_s record;
+        if (pos + (ssize) sizeof record > size) {
+            s_log_warn("journal log segment %s has a truncated record at %i, ignoring it", file, (int) pos);
+            break;
+        }
+        memcpy(&record, data + pos, sizeof record);
+        ssize entry_size = record_entry_size(record.is_pack);
+        ssize end = pos + (ssize) sizeof record + record.topic_size + entry_size;
+        if (record.is_pack > 1 || record.topic_size == 0 || record.topic_size >= HIGHSCORE_TOPIC_MAX_LENGTH
+            || end > size
+            || record.crc != (su32) crc32(0, (const Bytef *) data + pos + sizeof record.crc,
+                                          (uInt) (end - pos - (ssize) sizeof record.crc))) {
+            s_log_warn("journal log segment %s has an invalid record at %i, ignoring the rest", file, (int) pos);
+            break;
+        }
+
+        WriterEntry_s entry = {.is_pack = record.is_pack};
+        const char *at = data + pos + sizeof record;
+        memcpy(entry.topic, at, record.topic_size);
+        entry.topic[record.topic_size] = '\0';
+        memcpy(entry.is_pack ? (void *) &entry.pack_entry : (void *) &entry.entry, at + record.topic_size, entry_size);
+        journal_entries_push(&recover.entries, entry);
+        pos = end;
+    }
+    s_string_kill(&content);
+}
+
+// buckets the entries by the partition of their topic (counting sort), so each entry is only hashed once
+// entries of a partition keep their log order
+static void replay_partition() {
+    ssize n = recover.entries.size;
+    int *partition = s_new(int, s_max(1, n));
+    recover.starts = s_new0(ssize, recover.partitions + 1);
+    for (ssize i = 0; i < n; i++) {
+        const char *topic = recover.entries.array[i].topic;
+        partition[i] = (int) (crc32(0, (const Bytef *) topic, (uInt) strlen(topic)) % recover.partitions);
+        recover.starts[partition[i] + 1]++;
+    }
+    for (int p = 0; p < recover.partitions; p++) {
+        recover.starts[p + 1] += recover.starts[p];
+    }
+
+    ssize *fill = s_new(ssize, recover.partitions);
+    memcpy(fill, recover.starts, recover.partitions * sizeof *fill);
+    recover.indices = s_new(ssize, s_max(1, n));
+    for (ssize i = 0; i < n; i++) {
+        recover.indices[fill[partition[i]]++] = i;
+    }
+    s_free(fill);
+    s_free(partition);
+}
+
+// sorts entry indices by topic, entries of the same topic keep their log order
+static int replay_compare(const void *a, const void *b) {
+    ssize ia = *(const ssize *) a;
+    ssize ib = *(const ssize *) b;
+    int cmp = strcmp(recover.entries.array[ia].topic, recover.entries.array[ib].topic);
+    if (cmp != 0)
+        return cmp;
+    return ia < ib ? -1 : (ia > ib);
+}
+
+// each partition contains all entries of its topics, so the topics are replayed in parallel
+static void *replay_thread(void *arg) {
+    for (;;) {
+        int p = atomic_fetch_add(&recover.next, 1);
+        if (p >= recover.partitions)
+            break;
+
+        ssize *indices = recover.indices + recover.starts[p];
+        ssize n = recover.starts[p + 1] - recover.starts[p];
+        qsort(indices, n, sizeof *indices, replay_compare);
+
+        // apply all entries of a topic at once
+        for (ssize i = 0; i < n;) {
+            const WriterEntry_s *first = &recover.entries.array[indices[i]];
+            ssize end = i;
+            while (end < n && strcmp(recover.entries.array[indices[end]].topic, first->topic) == 0)
+                end++;
+
+            int adds_size = 0;
+            if (first->is_pack) {
+                HighscorePackEntry_s *adds = s_new(HighscorePackEntry_s, end - i);
+                for (ssize j = i; j < end; j++) {
+                    if (recover.entries.array[indices[j]].is_pack)
+                        adds[adds_size++] = recover.entries.array[indices[j]].pack_entry;
+                }
+                L.apply_pack(first->topic, adds, adds_size);
+                s_free(adds);
+            } else {
+                HighscoreEntry_s *adds = s_new(HighscoreEntry_s, end - i);
+                for (ssize j = i; j < end; j++) {
+                    if (!recover.entries.array[indices[j]].is_pack)
+                        adds[adds_size++] = recover.entries.array[indices[j]].entry;
+                }
+                L.apply(first->topic, adds, adds_size);
+                s_free(adds);
+            }
+            i = end;
+        }
+    }
+    return NULL;
+}
+
+// replays the log segments from segment until the last one
+// returns the last replayed segment
+static su64 replay(su64 segment) {
+    su64 max = segments_max();
+    recover.entries = journal_entries_new(1024);
+    for (su64 s = segment; s <= max; s++) {
+        replay_read(s);
+    }
+
+    // the topics are already loaded from the snapshot, so do not load their (older) topic files
+    topics_set_loading(false);
+    recover.partitions = s_clamp(L.threads, 1, JOURNAL_MAX_THREADS) * 4;
+    replay_partition();
+    parallel(L.threads, replay_thread);
+    topics_set_loading(true);
+
+    // the replayed topics are written with the next snapshot
+    for (ssize i = 0; i < recover.entries.size; i++) {
+        dirty_add(recover.entries.array[i].topic);
+    }
+
+    s_log("journal replayed %i entries of the log segments %llu - %llu",
+          (int) recover.entries.size, (unsigned long long) segment, (unsigned long long) max);
+    s_free(recover.indices);
+    s_free(recover.starts);
+    journal_entries_kill(&recover.entries);
+    return s_max(segment, max);
+}
+
+
+//
+// public
+//
+
+bool journal_init(enum persist_sync sync, int sync_interval_ms, int snapshot_interval_s, int threads,
+                  writer_apply_fn apply, writer_apply_pack_fn apply_pack) {
+    L.sync = sync;
+    L.sync_interval = sync_interval_ms / 1000.0;
+    L.snapshot_interval = snapshot_interval_s;
+    L.threads = threads;
+    L.apply = apply;
+    L.apply_pack = apply_pack;
+    L.buffer = s_string_new(4096);
+    L.dirty = journal_topics_new(256);
+    L.dirty_map = journal_dirty_map_new(JOURNAL_DIRTY_MAP_SIZE);
+    atomic_init(&L.snapshot_running, false);
+
+    // the apply functions do not write the topic files while replaying, see journal_enabled
+    L.enabled = true;
+
+    persist_make_dirs(JOURNAL_DIR);
+
+    sTimer_s timer = s_timer_new();
+    su64 segment = snapshot_load();
+    if (segment > 0) {
+        s_log("journal snapshot loaded (%.3f s)", s_timer_elapsed(timer));
+        su64 last = replay(segment);
+        if (!segment_open(last + 1))
+            return false;
+    } else {
+        // first start with the journal, the topic files are the base for the first snapshot
+        if (segments_max() > 0) {
+            s_log_warn("journal log segments without a snapshot found, removing them");
+            segments_remove_before(UINT64_MAX);
+        }
+        topics_preload(threads);
+        snapshot_start(false);
+        if (L.fd <= 0)
+            return false;
+    }
+    s_log("journal recovered in %.3f s", s_timer_elapsed(timer));
+
+    L.last_snapshot_time = s_time_monotonic();
+    L.last_sync_time = s_time_monotonic();
+    return true;
+}
+
+bool journal_enabled() {
+    return L.enabled;
+}
+
+void journal_add(const WriterEntry_s *entry) {
+    if (!L.enabled)
+        return;
+    ssize topic_size = (ssize) strlen(entry->topic);
+    const void *data = entry->is_pack ? (const void *) &entry->pack_entry : (const void *) &entry->entry;
+    ssize data_size = record_entry_size(entry->is_pack);
+
+    JournalRecord_s record = {.is_pack = entry->is_pack, .topic_size = (su8) topic_size};
+    uLong crc = crc32(0, (const Bytef *) &record + sizeof record.crc, sizeof record - sizeof record.crc);
+    crc = crc32(crc, (const Bytef *) entry->topic, (uInt) topic_size);
+    record.crc = (su32) crc32(crc, data, (uInt) data_size);
+
+    s_string_append(L.buffer, (sStr_s) {(char *) &record, sizeof record});
+    s_string_append(L.buffer, (sStr_s) {(char *) entry->topic, topic_size});
+    s_string_append(L.buffer, (sStr_s) {(char *) data, data_size});
+    L.buffer_records++;
+    dirty_add(entry->topic);
+}
+
+void journal_commit() {
+    if (!L.enabled)
+        return;
+
+    if (L.buffer->size > 0) {
+        if (!write_all(L.fd, L.buffer->data, L.buffer->size)) {
+            s_log_error("failed to append %i entries to the log segment", L.buffer_records);
+        } else if (L.sync == PERSIST_SYNC_ALWAYS) {
+            log_sync();
+        } else if (L.sync == PERSIST_SYNC_INTERVAL) {
+            L.unsynced = true;
+            journal_tick();
+        }
+        s_string_resize(L.buffer, 0);
+        L.buffer_records = 0;
+    }
+
+    if (s_time_monotonic() - L.last_snapshot_time >= L.snapshot_interval
+        && !atomic_load(&L.snapshot_running)) {
+        snapshot_start(true);
+    }
+}
+
+void journal_tick() {
+    if (!L.enabled || !L.unsynced)
+        return;
+    if (s_time_monotonic() - L.last_sync_time >= L.sync_interval)
+        log_sync();
+}
+
+int journal_tick_timeout_ms() {
+    if (!L.enabled || !L.unsynced)
+        return -1;
+    double remaining = L.sync_interval - (s_time_monotonic() - L.last_sync_time);
+    return (int) s_max(0, remaining * 1000.0 + 1);
+}
@@ -0,0 +1,49 @@
+#ifndef HIGHSCORESERVER_JOURNAL_H
+#define HIGHSCORESERVER_JOURNAL_H
+
+//
+// Snapshot and entry log of all topics
+//      the writer appends all entries of a batch to the current log segment (journal_add, journal_commit)
+//      every snapshot_interval_s, the writer switches to a new log segment
+//      and a snapshot thread writes the in memory topics into a binary snapshot
+//      (the topic data is immutable, so the writer goes on)
+//      log segments before the snapshot are deleted, as soon as the snapshot is written
+//      on startup, the snapshot is loaded and only the log tail since the snapshot is replayed,
+//      so the restart time is bounded by the snapshot interval
+//      snapshot loading and replay are parallelized per topic
+//      the log is the persistence of the entries, so the writer does not write the topic files,
+//      the snapshot thread writes the topic files of all topics changed since the last snapshot (see persist_flush)
+//      a log record only contains the topic and the entry of its type
+//
+
+#include "writer.h"
+#include "persist.h"
+
+// directory of the snapshot and the log segments
+#define JOURNAL_DIR "topics/journal"
+
+// loads the snapshot and replays the log tail with the apply functions
+// if no snapshot is available, all topic files are preloaded and a first snapshot is written
+// threads are used for loading and replaying in parallel
+// sync: PERSIST_SYNC_ALWAYS syncs the log on each commit, PERSIST_SYNC_INTERVAL every sync_interval_ms
+// returns false if the journal could not be opened
+bool journal_init(enum persist_sync sync, int sync_interval_ms, int snapshot_interval_s, int threads,
+                  writer_apply_fn apply, writer_apply_pack_fn apply_pack);
+
+// returns true if the journal is used (set at the start of journal_init)
+// the topic files are then written by the snapshots, not by the writer
+bool journal_enabled();
+
+// adds an applied entry to the log buffer (writer thread only)
+void journal_add(const WriterEntry_s *entry);
+
+// appends the log buffer to the log segment and starts a snapshot, if its interval elapsed (writer thread only)
+void journal_commit();
+
+// syncs the log, if the sync interval has elapsed and entries were appended since the last sync (writer thread only)
+void journal_tick();
+
+// returns the time in ms until journal_tick should be called, or -1 if not needed
+int journal_tick_timeout_ms();
+
+#endif //HIGHSCORESERVER_JOURNAL_H
@@ -0,0 +1,142 @@
+#include <string.h>
+#include "s/s.h"
+#include "leaderboard.h"
+
+static bool check_sorted(void *array, int n, size_t item_size, int (*comp_fun)(const void *a, const void *b)) {
+    for(int i=0; i<n-1; i++) {
+        void *a = ((char*) array)+i*item_size;
+        void *b = ((char*) array)+(i+1)*item_size;
+        if (comp_fun(a, b) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// bubble sort
+// not used, but here for... stuff... ... ...
+static void bsort(void *array, int n, size_t item_size, int (*comp_fun)(const void *a, const void *b)) {
+    void *tmp = malloc(item_size);
+    for (int i = 1; i < n; i++){
+        for (int j = 0; j < n - 1 ; j++){
+            void *a = ((char*) array)+i*item_size;
+            void *b = ((char*) array)+j*item_size;
+            if (comp_fun(a, b) < 0) {
+                memcpy(tmp, b, item_size);
+                memcpy(b, a, item_size);
+                memcpy(a, tmp, item_size);
+            }
+        }
+    }
+    free(tmp);
+}
+
+// sorted bubble sort
+// if the a and b are equal, they are not swapped!
+static void sbsort(void *array, int n, size_t item_size, int (*comp_fun)(const void *a, const void *b)) {
+    void *tmp = malloc(item_size);
+    for (int i = 1; i < n; i++){
+        for (int j = 0; j < n-1 ; j++){
+            void *a = ((char*) array)+j*item_size;
+            void *b = ((char*) array)+(j+1)*item_size;
+            if (comp_fun(a, b) > 0) {
+                memcpy(tmp, b, item_size);
+                memcpy(b, a, item_size);
+                memcpy(a, tmp, item_size);
+            }
+        }
+    }
+    free(tmp);
+}
+static int highscore_sort_compare(const void *a, const void *b) {
+    const HighscoreEntry_s *entry_a = a;
+    const HighscoreEntry_s *entry_b = b;
+    return entry_b->score - entry_a->score;
+}
+
+
+void highscore_sort(Highscore *self) {
+    if(!check_sorted(self->entries, self->entries_size, sizeof *self->entries, highscore_sort_compare)) {
+        sbsort(self->entries, self->entries_size, sizeof *self->entries, highscore_sort_compare);
+        s_log("highscore sorted...?!?");
+    }
+}
+
+static void highscore_remove_entry(Highscore *self, int idx) {
+    for (int i = idx; i < self->entries_size - 1; i++) {
+        self->entries[i] = self->entries[i + 1];
+    }
+    self->entries_size--;
+}
+
+static void highscore_add_new_entry(Highscore *self, HighscoreEntry_s add) {
+    self->entries = s_renew(HighscoreEntry_s , self->entries, self->entries_size + 1);
+
+    for (int i = 0; i < self->entries_size; i++) {
+        if (self->entries[i].score < add.score) {
+
+            // move others down
+            for (int j = self->entries_size - 1; j >= i; j--) {
+                self->entries[j + 1] = self->entries[j];
+            }
+
+            self->entries[i] = add;
+            self->entries_size++;
+            return;
+        }
+    }
+
+    // add is the last
+    self->entries[self->entries_size++] = add;
+}
+
+void highscore_add_entry(Highscore *self, HighscoreEntry_s add) {
+    if (add.name[0] == '\0')
+        return;
+
+    int search = -1;
+    for (int i = 0; i < self->entries_size; i++) {
+        if (strcmp(self->entries[i].name, add.name) == 0) {
+            if (search>=0) {
+                highscore_remove_entry(self, i);
+                i--;    // retry the new entry on i, cause the old has been removed
+                continue;
+            }
+            search = i;
+        }
+    }
+
+    if (search>=0) {
+        if (self->entries[search].score < add.score) {
+            highscore_remove_entry(self, search);
+            highscore_add_new_entry(self, add);
+        }
+    } else {
+        highscore_add_new_entry(self, add);
+    }
+}
+
+void highscorepack_add_entry(HighscorePack *self, HighscorePackEntry_s add) {
+    if (add.text[0] == '\0')
+        return;
+
+    int entries_size = self->entries_size + 1;
+    if(entries_size>HIGHSCORE_PACK_MAX_ENTRIES) {
+        entries_size = HIGHSCORE_PACK_MAX_ENTRIES;
+    }
+
+    HighscorePackEntry_s *entries = s_new(HighscorePackEntry_s, entries_size);
+
+    // first is the new in the fifo ring
+    entries[0] = add;
+
+    // copy rest (could be a memcpy, but I was to lazy to calc the bytes, so let the compiler optimize it...)
+    for(int i=1; i<entries_size; i++) {
+        entries[i] = self->entries[i-1];
+    }
+
+    // move
+    free(self->entries);
+    self->entries = entries;
+    self->entries_size = entries_size;
+}
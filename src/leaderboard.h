@@ -0,0 +1,30 @@
+#ifndef HIGHSCORESERVER_LEADERBOARD_H
+#define HIGHSCORESERVER_LEADERBOARD_H
+
+//
+// Leaderboard operations on the decoded topics
+//      a highscore is kept sorted by score (descending) with a single entry per name
+//      a pack is a FIFO ring buffer, the newest entry first
+//
+
+#include "highscore.h"
+
+// so the number score position ranges from 1:999
+#define HIGHSCORE_MAX_ENTRIES 999
+
+// max ring buffer size
+#define HIGHSCORE_PACK_MAX_ENTRIES 128
+
+// sorts the entries by score, if they are not sorted already (stable)
+void highscore_sort(Highscore *self);
+
+// adds the entry or raises the score of the entry with the same name
+// entries with an empty name are ignored
+// the caller truncates the highscore to HIGHSCORE_MAX_ENTRIES
+void highscore_add_entry(Highscore *self, HighscoreEntry_s add);
+
+// adds the entry as first entry of the ring buffer, which is truncated to HIGHSCORE_PACK_MAX_ENTRIES
+// entries with an empty text are ignored
+void highscorepack_add_entry(HighscorePack *self, HighscorePackEntry_s add);
+
+#endif //HIGHSCORESERVER_LEADERBOARD_H
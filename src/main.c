@@ -1,22 +1,183 @@
 #include <stdio.h>
+#include <strings.h>
 #include <limits.h>
 #include <microhttpd.h>
 #include <pthread.h>
-
-#include "s/s_impl.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "s/s.h"
+#include "s/str.h"
+#include "s/string.h"
+#include "s/file.h"
+#include "s/socket.h"
+#include "s/time.h"
 
 #include "highscore.h"
+#include "topics.h"
+#include "ratelimit.h"
+#include "writer.h"
+#include "persist.h"
+#include "journal.h"
+#include "store.h"
+#include "cold.h"
+#include "metrics.h"
+#include "engine.h"
+#include "shmring.h"
+
+
+// TCP port of the http server, 0 to only listen on the unix domain socket
+#ifndef SERVER_PORT
+#define SERVER_PORT 10000
+#endif
 
+// path of a unix domain socket for the http server (for a reverse proxy on the same machine), "" to disable
+// listens alongside the TCP port, or instead of it with SERVER_PORT 0
+// clients of the unix socket have no ip, so the ip rate limit does not apply to them
+#ifndef SERVER_UNIX_SOCKET
+#define SERVER_UNIX_SOCKET ""
+#endif
 
-// so the number score position ranges from 1:999
-#define HIGHSCORE_MAX_ENTRIES 999
+// permissions of the socket file, the proxy needs write permission to connect
+#define SERVER_UNIX_SOCKET_MODE 0660
 
-// max ring buffer size
-#define HIGHSCORE_PACK_MAX_ENTRIES 128
+// UDP port for fire-and-forget score entries, 0 to disable the udp listener
+#ifndef SERVER_UDP_PORT
+#define SERVER_UDP_PORT 0
+#endif
 
+// max datagrams received with a single syscall
+#define UDP_BATCH_SIZE 32
 
+// max size of a single datagram, larger datagrams are truncated and thus invalid
+#define UDP_DATAGRAM_MAX_SIZE 2048
 
-#define SERVER_PORT 10000
+// records of the shared memory submission ring for local producers (see shmring.h), 0 to disable
+#ifndef SERVER_SHM_RING_SIZE
+#define SERVER_SHM_RING_SIZE 0
+#endif
+#define SERVER_SHM_RING_NAME "/highscore_entries"
+
+// max records drained at once and the sleep time of the drain thread, if the ring is empty
+#define SHM_RING_BATCH_SIZE 256
+#define SHM_RING_IDLE_US 1000
+
+// how topics are sent back:
+// SEND_MODE_BUFFER reads the topic file into a buffer for each GET
+// SEND_MODE_SENDFILE sends the topic file with sendfile (MHD_create_response_from_fd), without copying it into memory
+// SEND_MODE_STREAM encodes the entries of the in memory topic directly into the response buffer of MHD
+#define SEND_MODE_BUFFER 0
+#define SEND_MODE_SENDFILE 1
+#define SEND_MODE_STREAM 2
+#ifndef SERVER_SEND_MODE
+#define SERVER_SEND_MODE SEND_MODE_STREAM
+#endif
+
+// block size for the streamed responses of SEND_MODE_STREAM
+#define STREAM_BLOCK_SIZE 4096
+
+// token bucket rate limits for POST requests (and udp datagrams), per client ip and per topic
+// the rates are tokens (requests) per second, 0 to disable the limit
+// excess requests are rejected with 429, before the entry is decoded
+// the ip limit is off by default: behind a reverse proxy all clients share the ip of the proxy
+// ipv6 clients are limited per /64 prefix, which is usually a single host or site
+#ifndef RATELIMIT_IP_PER_SEC
+#define RATELIMIT_IP_PER_SEC 0
+#endif
+#define RATELIMIT_IP_BURST 20
+#ifndef RATELIMIT_TOPIC_PER_SEC
+#define RATELIMIT_TOPIC_PER_SEC 200
+#endif
+#define RATELIMIT_TOPIC_BURST 400
+
+// max entries that may be queued for the writer thread (see writer.h) at once
+// excess POST requests are shed with 503 and Retry-After, excess udp entries are dropped
+#ifndef ADMISSION_QUEUE_DEPTH
+#define ADMISSION_QUEUE_DEPTH 64
+#endif
+
+// sync policy of the topic files, see persist.h
+#ifndef PERSIST_SYNC
+#define PERSIST_SYNC PERSIST_SYNC_INTERVAL
+#endif
+#define PERSIST_SYNC_INTERVAL_MS 1000
+
+// write behind, dirty topics are written every PERSIST_FLUSH_INTERVAL_MS
+// or as soon as PERSIST_FLUSH_DIRTY_MAX topics are dirty
+// 0 to write the topics before the entries are acknowledged (write through)
+// note: with write behind (the default), a POST is acknowledged as soon as its entry is applied in memory,
+//       before it is written or synced, so a crash may lose the entries of the last flush and sync interval
+//       only write through with PERSIST_SYNC_ALWAYS acknowledges after the entry is durable
+#ifndef PERSIST_FLUSH_INTERVAL_MS
+#define PERSIST_FLUSH_INTERVAL_MS 1000
+#endif
+#define PERSIST_FLUSH_DIRTY_MAX 4096
+
+// 1 to store all topics in the single file store TOPICS_STORE_FILE instead of a topic file per topic
+// (topic files are still read, for topics that are not in the store yet)
+#ifndef TOPICS_STORE
+#define TOPICS_STORE 0
+#endif
+#define TOPICS_STORE_FILE "topics/store.bin"
+
+// memory budget of the in memory topics, the least recently used topics are evicted
+// 0 for unlimited (not used with the journal, its snapshots need all topics in memory)
+#ifndef TOPICS_MEMORY_BUDGET_MB
+#define TOPICS_MEMORY_BUDGET_MB 0
+#endif
+
+// topics, that are not in memory and whose topic file was not used for TOPICS_COLD_AFTER_S,
+// are moved into the compressed archive TOPICS_COLD_FILE (see cold.h), 0 to disable
+// (not used with the store or the journal)
+#ifndef TOPICS_COLD_AFTER_S
+#define TOPICS_COLD_AFTER_S 0
+#endif
+#define TOPICS_COLD_SCAN_INTERVAL_S 3600
+#define TOPICS_COLD_FILE "topics/cold.bin"
+
+// threads to preload all topics at startup, 0 to load the topics on first use
+#ifndef TOPICS_PRELOAD_THREADS
+#define TOPICS_PRELOAD_THREADS 0
+#endif
+
+// snapshot interval of the journal (snapshot + entry log, see journal.h), 0 to disable the journal
+#ifndef JOURNAL_SNAPSHOT_INTERVAL_S
+#define JOURNAL_SNAPSHOT_INTERVAL_S 0
+#endif
+#define JOURNAL_THREADS 8
+
+// 1 to send the cached gzip or deflate variant of a topic, if the client accepts it (Accept-Encoding)
+#ifndef SERVER_COMPRESSION
+#define SERVER_COMPRESSION 1
+#endif
+
+// 1 to serve the metrics in the prometheus text format on GET /metrics (see metrics.h)
+#ifndef SERVER_METRICS
+#define SERVER_METRICS 1
+#endif
+
+// requests slower than this log the time of each stage (validate, decode, writer, ...), 0 to disable
+#ifndef SERVER_SLOW_REQUEST_MS
+#define SERVER_SLOW_REQUEST_MS 100
+#endif
+
+// 1 to write the log on a log thread, so requests do not wait for stdout (see s/log.h)
+#ifndef SERVER_LOG_ASYNC
+#define SERVER_LOG_ASYNC 1
+#endif
+
+// buffered log messages of all threads, further messages are dropped until the log thread caught up
+// each message takes about 600 bytes
+#define SERVER_LOG_ASYNC_RING_SIZE 1024
+
+// min log level at start, the per request logs are S_LOG_DEBUG
+// changed at runtime with the signals SIGUSR1 (more verbose) and SIGUSR2 (less verbose)
+#ifndef SERVER_LOG_LEVEL
+#define SERVER_LOG_LEVEL S_LOG_INFO
+#endif
 
 
 //#define DEBUG_MODE
@@ -26,7 +187,7 @@
  */
 
 /**
- * HTTP Server API:
+ * HTTP Server API: (on SERVER_PORT and / or SERVER_UNIX_SOCKET)
  * GET /path/to/topic
  *      returns the topic file, if available
  * POST /path/to/topic
@@ -68,6 +229,15 @@
  * padding to end with '\0'
  */
 
+/**
+ * UDP API: (only if SERVER_UDP_PORT > 0)
+ * datagram="<TOPIC>\n<ENTRY>\n<ENTRY>..."
+ *      topic as in the HTTP API, without the leading /api/ (so pack topics start with pack/)
+ *      entries as in the HTTP API of the topic type, one per line
+ *      fire and forget, nothing is sent back and invalid entries are dropped
+ *      datagrams larger than UDP_DATAGRAM_MAX_SIZE are dropped as a whole (highscore_udp_truncated_total)
+ */
+
 // protected functions:
 
 HighscoreEntry_s highscore_entry_decode(sStr_s entry);
@@ -92,264 +262,334 @@ sString *highscorepack_encode(HighscorePack self);
 
 
 static struct {
-    pthread_mutex_t lock;
-} L = {PTHREAD_MUTEX_INITIALIZER};
-
-static void make_dirs(const char *topic) {
-#ifdef DEBUG_MODE
-    s_log("MAKE_DIRS not performed, in DEBUG_MODE");
-#else
-    char file[256];
-    snprintf(file, 256, "topics/%s", topic);
-
-    char syscall[256 + 32];
-    snprintf(syscall, 256 + 32, "mkdir -p %s", file);
-
-    system(syscall);
-#endif
+    // NULL if disabled
+    RateLimit *ratelimit_ip;
+    RateLimit *ratelimit_topic;
+
+    // keeps the pre bound listen socket of the unix domain socket daemon, NULL if disabled
+    sSocketServer *unix_server;
+
+    // NULL if disabled
+    ShmRing *shm_ring;
+
+    // datagrams dropped by the udp listener, cause they exceeded UDP_DATAGRAM_MAX_SIZE
+    atomic_uint_fast64_t udp_truncated;
+} L;
+
+// state of a POST request, stored in the MHD connection pointer (*ptr)
+enum post_state {
+    POST_NONE,
+    POST_STARTED,
+    POST_RATE_LIMITED,
+    POST_SHED
+};
+
+// queues the response and sets the status of the request metrics
+static int http_queue_response(struct MHD_Connection *connection, unsigned int status,
+                               struct MHD_Response *response) {
+    metrics_request_status(status);
+    sTimer_s timer = s_timer_new();
+    int ret = MHD_queue_response(connection, status, response);
+    metrics_stage(METRICS_STAGE_RESPONSE, timer);
+    return ret;
 }
 
+// sends the topic file with sendfile
+// no lock needed, topic files are replaced atomically with a rename (see persist.c)
+// so an opened file always contains a complete topic
+static int http_send_topic_fd(struct MHD_Connection *connection, const char *file) {
+    sTimer_s timer = s_timer_new();
+    int fd = open(file, O_RDONLY);
 
-static bool check_sorted(void *array, int n, size_t item_size, int (*comp_fun)(const void *a, const void *b)) {
-    for(int i=0; i<n-1; i++) {
-        void *a = ((char*) array)+i*item_size;
-        void *b = ((char*) array)+(i+1)*item_size;
-        if (comp_fun(a, b) > 0) {
-            return false;
-        }
+    if (fd < 0) {
+        s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "failed to open topic file: %s", file);
+        return MHD_NO;
     }
-    return true;
-}
 
-// bubble sort
-// not used, but here for... stuff... ... ...
-static void bsort(void *array, int n, size_t item_size, int (*comp_fun)(const void *a, const void *b)) {
-    void *tmp = malloc(item_size);
-    for (int i = 1; i < n; i++){
-        for (int j = 0; j < n - 1 ; j++){
-            void *a = ((char*) array)+i*item_size;
-            void *b = ((char*) array)+j*item_size;
-            if (comp_fun(a, b) < 0) {
-                memcpy(tmp, b, item_size);
-                memcpy(b, a, item_size);
-                memcpy(a, tmp, item_size);
-            }
-        }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "failed to stat topic file: %s", file);
+        close(fd);
+        return MHD_NO;
     }
-    free(tmp);
-}
 
-// sorted bubble sort
-// if the a and b are equal, they are not swapped!
-static void sbsort(void *array, int n, size_t item_size, int (*comp_fun)(const void *a, const void *b)) {
-    void *tmp = malloc(item_size);
-    for (int i = 1; i < n; i++){
-        for (int j = 0; j < n-1 ; j++){
-            void *a = ((char*) array)+j*item_size;
-            void *b = ((char*) array)+(j+1)*item_size;
-            if (comp_fun(a, b) > 0) {
-                memcpy(tmp, b, item_size);
-                memcpy(b, a, item_size);
-                memcpy(a, tmp, item_size);
-            }
-        }
+    metrics_add(METRICS_FILE_READ_BYTES, st.st_size);
+    metrics_stage(METRICS_STAGE_FILE_READ, timer);
+
+    // the response owns the fd now and closes it on destroy
+    struct MHD_Response *response = MHD_create_response_from_fd((size_t) st.st_size, fd);
+    if (!response) {
+        s_log("http_send_highscore failed to create the fd response");
+        close(fd);
+        return MHD_NO;
     }
-    free(tmp);
-}
-static int highscore_sort_compare(const void *a, const void *b) {
-    const HighscoreEntry_s *entry_a = a;
-    const HighscoreEntry_s *entry_b = b;
-    return entry_b->score - entry_a->score;
-}
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*");
 
+    int ret = http_queue_response(connection, MHD_HTTP_OK, response);
+    if (!ret)
+        s_log("http_send_highscore failed to queue response");
+    MHD_destroy_response(response);
+    return ret;
+}
 
-static void highscore_sort(Highscore *self) {
-    if(!check_sorted(self->entries, self->entries_size, sizeof *self->entries, highscore_sort_compare)) {
-        sbsort(self->entries, self->entries_size, sizeof *self->entries, highscore_sort_compare);
-        s_log("highscore sorted...?!?");
+// content encoding of a topic response
+enum topic_encoding {
+    TOPIC_ENCODING_IDENTITY,
+    TOPIC_ENCODING_GZIP,
+    TOPIC_ENCODING_DEFLATE
+};
+
+// state of a streamed topic response (SEND_MODE_STREAM) or of a compressed topic response
+typedef struct {
+    TopicData *data;
+    enum topic_encoding encoding;
+    int next_entry;
+
+    // current encoded entry line, which may not fit into a single MHD buffer
+    char line[HIGHSCORE_PACK_MAX_ENTRY_LENGTH + 1];
+    int line_pos;
+    int line_size;
+} TopicStream_s;
+
+// encodes the next entry into the line buffer, returns false if all entries are encoded
+static bool topicstream_next_line(TopicStream_s *self) {
+    if (self->data->is_pack) {
+        if (self->next_entry >= self->data->pack.entries_size)
+            return false;
+        highscorepack_entry_encode(self->data->pack.entries[self->next_entry], self->line);
+    } else {
+        if (self->next_entry >= self->data->highscore.entries_size)
+            return false;
+        highscore_entry_encode(self->data->highscore.entries[self->next_entry], self->line);
     }
+    self->next_entry++;
+    self->line_size = (int) strlen(self->line);
+    self->line[self->line_size++] = '\n';
+    self->line_pos = 0;
+    return true;
 }
 
-static void highscore_remove_entry(Highscore *self, int idx) {
-    for (int i = idx; i < self->entries_size - 1; i++) {
-        self->entries[i] = self->entries[i + 1];
+// MHD_ContentReaderCallback
+// fills the MHD buffer with the encoded entries
+static ssize_t http_stream_read(void *cls, uint64_t pos, char *buf, size_t max) {
+    TopicStream_s *self = cls;
+    size_t written = 0;
+    while (written < max) {
+        if (self->line_pos >= self->line_size && !topicstream_next_line(self))
+            break;
+        size_t n = s_min(max - written, (size_t) (self->line_size - self->line_pos));
+        memcpy(buf + written, self->line + self->line_pos, n);
+        self->line_pos += (int) n;
+        written += n;
     }
-    self->entries_size--;
+    if (written == 0)
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    return (ssize_t) written;
 }
 
-static void highscore_add_new_entry(Highscore *self, HighscoreEntry_s add) {
-    self->entries = s_renew(HighscoreEntry_s , self->entries, self->entries_size + 1);
+// MHD_ContentReaderFreeCallback
+static void http_stream_free(void *cls) {
+    TopicStream_s *self = cls;
+    topicdata_unref(&self->data);
+    s_free(self);
+}
 
-    for (int i = 0; i < self->entries_size; i++) {
-        if (self->entries[i].score < add.score) {
+// streams the in memory topic into the response
+// the response holds a reference of the immutable topic data, so no lock is needed while sending
+static int http_send_topic_stream(struct MHD_Connection *connection, const char *topic) {
+    TopicData *data = topics_get(topic);
+    if (!data) {
+        s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "failed to get topic: %s", topic);
+        return MHD_NO;
+    }
 
-            // move others down
-            for (int j = self->entries_size - 1; j >= i; j--) {
-                self->entries[j + 1] = self->entries[j];
-            }
+    TopicStream_s *stream = s_new0(TopicStream_s, 1);
+    stream->data = data;
 
-            self->entries[i] = add;
-            self->entries_size++;
-            return;
-        }
+    struct MHD_Response *response = MHD_create_response_from_callback((uint64_t) data->encoded_size,
+                                                                      STREAM_BLOCK_SIZE,
+                                                                      http_stream_read, stream,
+                                                                      http_stream_free);
+    if (!response) {
+        s_log("http_send_highscore failed to create the stream response");
+        http_stream_free(stream);
+        return MHD_NO;
     }
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*");
 
-    // add is the last
-    self->entries[self->entries_size++] = add;
+    int ret = http_queue_response(connection, MHD_HTTP_OK, response);
+    if (!ret)
+        s_log("http_send_highscore failed to queue response");
+    MHD_destroy_response(response);
+    return ret;
 }
 
-static void highscore_add_entry(Highscore *self, HighscoreEntry_s add) {
-    if (add.name[0] == '\0')
-        return;
-
-    int search = -1;
-    for (int i = 0; i < self->entries_size; i++) {
-        if (strcmp(self->entries[i].name, add.name) == 0) {
-            if (search>=0) {
-                highscore_remove_entry(self, i);
-                i--;    // retry the new entry on i, cause the old has been removed
-                continue;
-            }
-            search = i;
-        }
+// returns the q value of a "q=<value>" parameter in thousandths (0..1000), or 1000 if it is not valid
+static int http_quality_parse(sStr_s value) {
+    if (s_str_empty(value) || (value.data[0] != '0' && value.data[0] != '1'))
+        return 1000;
+    int quality = (value.data[0] - '0') * 1000;
+    value = s_str_eat(value, 1);
+    if (s_str_empty(value))
+        return quality;
+    if (value.data[0] != '.' || value.size > 4)
+        return 1000;
+    int scale = 100;
+    for (ssize i = 1; i < value.size; i++, scale /= 10) {
+        if (value.data[i] < '0' || value.data[i] > '9')
+            return 1000;
+        quality += (value.data[i] - '0') * scale;
     }
+    return s_min(quality, 1000);
+}
 
-    if (search>=0) {
-        if (self->entries[search].score < add.score) {
-            highscore_remove_entry(self, search);
-            highscore_add_new_entry(self, add);
+// returns the q value of the encoding in the Accept-Encoding header value in thousandths (0..1000)
+// an explicitly listed encoding takes precedence over "*", so "*;q=0, gzip" accepts gzip
+// returns 0 if the encoding is not accepted
+static int http_encoding_quality(const char *accept_encoding, const char *encoding) {
+    if (!accept_encoding)
+        return 0;
+    int quality = -1;
+    int wildcard = -1;
+    sStr_s list = s_strc(accept_encoding);
+    while (!s_str_empty(list)) {
+        sStr_s item;
+        list = s_str_eat_until(list, ',', &item);
+        list = s_str_eat(list, 1);  // ,
+
+        sStr_s name;
+        sStr_s params = s_str_eat_until(item, ';', &name);
+        name = s_str_strip(name, ' ');
+
+        int q = 1000;
+        while (!s_str_empty(params)) {
+            sStr_s param;
+            params = s_str_eat(params, 1);  // ;
+            params = s_str_eat_until(params, ';', &param);
+            param = s_str_strip(param, ' ');
+            if (s_str_begins_with(param, s_strc("q=")) || s_str_begins_with(param, s_strc("Q=")))
+                q = http_quality_parse(s_str_eat(param, 2));
         }
-    } else {
-        highscore_add_new_entry(self, add);
+
+        if (name.size == (ssize) strlen(encoding) && strncasecmp(name.data, encoding, name.size) == 0)
+            quality = q;
+        else if (s_str_equals(name, s_strc("*")))
+            wildcard = q;
     }
+    if (quality >= 0)
+        return quality;
+    return s_max(wildcard, 0);
 }
 
-static void highscorepack_add_entry(HighscorePack *self, HighscorePackEntry_s add) {
-    if (add.text[0] == '\0')
-        return;
-
-    int entries_size = self->entries_size + 1;
-    if(entries_size>HIGHSCORE_PACK_MAX_ENTRIES) {
-        entries_size = HIGHSCORE_PACK_MAX_ENTRIES;
-    }
+// MHD_ContentReaderCallback
+// copies the compressed variant of the stream encoding into the MHD buffer
+static ssize_t http_compressed_read(void *cls, uint64_t pos, char *buf, size_t max) {
+    TopicStream_s *self = cls;
+    sString *compressed = self->encoding == TOPIC_ENCODING_GZIP ? self->data->gzip : self->data->deflate;
+    if (pos >= (uint64_t) compressed->size)
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    size_t n = s_min(max, (size_t) (compressed->size - pos));
+    memcpy(buf, compressed->data + pos, n);
+    return (ssize_t) n;
+}
 
-    HighscorePackEntry_s *entries = s_new(HighscorePackEntry_s, entries_size);
+// sends the cached gzip or deflate variant of the topic, if accepted by the client
+// returns MHD_NO and sets *sent to false, if no variant was sent
+static int http_send_topic_compressed(struct MHD_Connection *connection, const char *topic, bool *sent) {
+    *sent = false;
+    const char *accept = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+                                                     MHD_HTTP_HEADER_ACCEPT_ENCODING);
+    // the higher q value wins, gzip on a tie
+    int gzip_quality = http_encoding_quality(accept, "gzip");
+    int deflate_quality = http_encoding_quality(accept, "deflate");
+    if (gzip_quality == 0 && deflate_quality == 0)
+        return MHD_NO;
+    bool gzip = gzip_quality >= deflate_quality;
 
-    // first is the new in the fifo ring
-    entries[0] = add;
+    TopicData *data = topics_get(topic);
+    if (!data || !data->gzip) {
+        // not available or too small to be compressed
+        topicdata_unref(&data);
+        return MHD_NO;
+    }
 
-    // copy rest (could be a memcpy, but I was to lazy to calc the bytes, so let the compiler optimize it...)
-    for(int i=1; i<entries_size; i++) {
-        entries[i] = self->entries[i-1];
+    TopicStream_s *stream = s_new0(TopicStream_s, 1);
+    stream->data = data;
+    stream->encoding = gzip ? TOPIC_ENCODING_GZIP : TOPIC_ENCODING_DEFLATE;
+    sString *compressed = gzip ? data->gzip : data->deflate;
+
+    struct MHD_Response *response = MHD_create_response_from_callback((uint64_t) compressed->size,
+                                                                      STREAM_BLOCK_SIZE,
+                                                                      http_compressed_read, stream,
+                                                                      http_stream_free);
+    if (!response) {
+        s_log("http_send_highscore failed to create the compressed response");
+        http_stream_free(stream);
+        return MHD_NO;
     }
+    *sent = true;
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_ENCODING, gzip ? "gzip" : "deflate");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*");
 
-    // move
-    free(self->entries);
-    self->entries = entries;
-    self->entries_size = entries_size;
+    int ret = http_queue_response(connection, MHD_HTTP_OK, response);
+    if (!ret)
+        s_log("http_send_highscore failed to queue response");
+    MHD_destroy_response(response);
+    return ret;
 }
 
-// topic and entry must be 0 terminated!
-// returns false if the entry was not valid
-static bool save_entry(sStr_s topic, sStr_s entry) {
-    HighscoreEntry_s add = highscore_entry_decode(entry);
-    if (add.name[0] == '\0')
-        return false;
-
-    make_dirs(topic.data);
-    char file[256];
-    snprintf(file, 256, "topics/%s.txt", topic.data);
-
-    pthread_mutex_lock(&L.lock);
-    {
-        sString *msg = s_file_read(file, true);
-
-        Highscore highscore = highscore_decode(s_string_get_str(msg));
-        s_string_kill(&msg);
-
-        highscore_add_entry(&highscore, add);
-
-        if (highscore.entries_size > HIGHSCORE_MAX_ENTRIES) {
-            highscore.entries_size = HIGHSCORE_MAX_ENTRIES;
-        }
-
-        highscore_sort(&highscore);
-
-        sString *save = highscore_encode(highscore);
-        highscore_kill(&highscore);
-
-        if (!s_file_write(file, s_string_get_str(save), true)) {
-            s_log("failed to save topic file: %s", file);
-        } else {
-            s_log("new highscore saved");
-        }
+static int http_send_highscore(struct MHD_Connection *connection, const char *topic) {
+    s_log_debug("http_send_highscore");
 
-        s_string_kill(&save);
+    if (SERVER_COMPRESSION) {
+        bool sent;
+        int ret = http_send_topic_compressed(connection, topic, &sent);
+        if (sent)
+            return ret;
     }
-    pthread_mutex_unlock(&L.lock);
-
-    return true;
-}
-
-// topic and entry must be 0 terminated!
-// returns false if the entry was not valid
-static bool save_pack_entry(sStr_s topic, sStr_s entry) {
-    HighscorePackEntry_s add = highscorepack_entry_decode(entry);
-    if (add.text[0] == '\0')
-        return false;
 
-    make_dirs(topic.data);
     char file[256];
-    snprintf(file, 256, "topics/%s.txt", topic.data);
-
-    pthread_mutex_lock(&L.lock);
-    {
-        sString *msg = s_file_read(file, true);
-
-        HighscorePack highscore = highscorepack_decode(s_string_get_str(msg));
-        s_string_kill(&msg);
+    snprintf(file, 256, "topics/%s.txt", topic);
 
-        highscorepack_add_entry(&highscore, add);
+    // with the journal, the topic files are only written with its snapshots
+    if (SERVER_SEND_MODE == SEND_MODE_STREAM || journal_enabled())
+        return http_send_topic_stream(connection, topic);
 
-        sString *save = highscorepack_encode(highscore);
-        highscorepack_kill(&highscore);
+    // with write behind, a dirty topic is newer in memory than its file (or has no file yet)
+    // so it is streamed, to keep read your writes (and the same data as the compressed variant)
+    if (PERSIST_FLUSH_INTERVAL_MS > 0 && !persist_clean(topic))
+        return http_send_topic_stream(connection, topic);
 
-        if (!s_file_write(file, s_string_get_str(save), true)) {
-            s_log("failed to save topic file: %s", file);
-        } else {
-            s_log("new highscore saved");
-        }
+    // a cold topic has no topic file, until topics_get restores it
+    if (cold_enabled() && access(file, F_OK) != 0)
+        return http_send_topic_stream(connection, topic);
 
-        s_string_kill(&save);
-    }
-    pthread_mutex_unlock(&L.lock);
+    // the store has no file per topic to send
+    if (SERVER_SEND_MODE == SEND_MODE_SENDFILE && !store_enabled())
+        return http_send_topic_fd(connection, file);
 
-    return true;
-}
-
-static int http_send_highscore(struct MHD_Connection *connection, const char *topic) {
-    s_log("http_send_highscore");
-    char file[256];
-    snprintf(file, 256, "topics/%s.txt", topic);
-
-    sString *msg;
-
-    pthread_mutex_lock(&L.lock);
-    {
+    // lock free, see http_send_topic_fd
+    sTimer_s timer = s_timer_new();
+    sString *msg = store_enabled() ? store_read(topic) : s_string_new_invalid();
+    if (!s_string_valid(msg))
         msg = s_file_read(file, true);
-    }
-    pthread_mutex_unlock(&L.lock);
+    metrics_stage(METRICS_STAGE_FILE_READ, timer);
 
     if (!s_string_valid(msg)) {
-        s_log("failed to read topic file: %s", topic);
+        s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "failed to read topic file: %s", topic);
         return MHD_NO;
     }
+    metrics_add(METRICS_FILE_READ_BYTES, msg->size);
 
     struct MHD_Response *response = MHD_create_response_from_buffer(msg->size, msg->data, MHD_RESPMEM_MUST_COPY);
     MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain");
     MHD_add_response_header(response, MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*");
 
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    int ret = http_queue_response(connection, MHD_HTTP_OK, response);
     if (!ret)
         s_log("http_send_highscore failed to queue response");
     MHD_destroy_response(response);
@@ -358,6 +598,110 @@ static int http_send_highscore(struct MHD_Connection *connection, const char *to
 }
 
 
+// sends an empty response with the status code, opt_retry_after is added as Retry-After header
+static int http_send_status(struct MHD_Connection *connection, unsigned int status, const char *opt_retry_after) {
+    struct MHD_Response *response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*");
+    if (opt_retry_after)
+        MHD_add_response_header(response, MHD_HTTP_HEADER_RETRY_AFTER, opt_retry_after);
+    int ret = http_queue_response(connection, status, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// returns false if the client ip or the topic exceeds its rate limit
+static bool http_ratelimit_take(struct MHD_Connection *connection, const char *topic) {
+    if (L.ratelimit_ip) {
+        const union MHD_ConnectionInfo *info = MHD_get_connection_info(connection,
+                                                                       MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+        const struct sockaddr *addr = info ? info->client_addr : NULL;
+        su64 key = 0;
+        if (addr && addr->sa_family == AF_INET) {
+            const struct sockaddr_in *in = (const struct sockaddr_in *) addr;
+            key = ratelimit_key(&in->sin_addr, sizeof in->sin_addr);
+        } else if (addr && addr->sa_family == AF_INET6) {
+            // the /64 prefix, a single client may use any address of its prefix
+            const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *) addr;
+            key = ratelimit_key(&in6->sin6_addr, 8);
+        }
+        if (key && !ratelimit_take(L.ratelimit_ip, key)) {
+            s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "rate limit exceeded for a client ip");
+            return false;
+        }
+    }
+    if (L.ratelimit_topic && !ratelimit_take(L.ratelimit_topic, ratelimit_key_str(topic))) {
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "rate limit exceeded for topic: %s", topic);
+        return false;
+    }
+    return true;
+}
+
+// sends the metrics of metrics.h and the stats of the other modules
+static int http_send_metrics(struct MHD_Connection *connection) {
+    sString *out = metrics_render();
+
+    TopicsStats_s topics = topics_stats();
+    metrics_write(out, "highscore_topics_cached", "gauge", "topics in memory", (double) topics.topics);
+    metrics_write(out, "highscore_topics_cached_bytes", "gauge", "approximated memory of the topics in memory",
+                  (double) topics.bytes);
+    metrics_write(out, "highscore_topics_budget_bytes", "gauge", "memory budget of the topics, 0 for unlimited",
+                  (double) s_max(0, topics.budget));
+    metrics_write(out, "highscore_topics_hits_total", "counter", "topics found in memory", (double) topics.hits);
+    metrics_write(out, "highscore_topics_misses_total", "counter", "topics not found in memory",
+                  (double) topics.misses);
+    metrics_write(out, "highscore_topics_evictions_total", "counter", "topics evicted from memory",
+                  (double) topics.evictions);
+
+    metrics_write(out, "highscore_writer_pending", "gauge", "entries submitted and not applied yet",
+                  writer_pending());
+    metrics_write(out, "highscore_admission_shed_total", "counter", "entries not accepted by the full writer queue",
+                  (double) engine_admission_shed());
+    metrics_write(out, "highscore_persist_flushed_total", "counter", "written topic files",
+                  (double) persist_flushed());
+    metrics_write(out, "highscore_persist_coalesced_total", "counter", "topic updates coalesced into a single write",
+                  (double) persist_coalesced());
+    metrics_write(out, "highscore_ratelimit_ip_rejected_total", "counter", "requests rejected by the ip rate limit",
+                  L.ratelimit_ip ? (double) ratelimit_rejected(L.ratelimit_ip) : 0);
+    metrics_write(out, "highscore_ratelimit_topic_rejected_total", "counter",
+                  "requests and datagrams rejected by the topic rate limit",
+                  L.ratelimit_topic ? (double) ratelimit_rejected(L.ratelimit_topic) : 0);
+    metrics_write(out, "highscore_shm_ring_pending", "gauge", "records in the shared memory ring, not drained yet",
+                  L.shm_ring ? (double) shmring_pending(L.shm_ring) : 0);
+    metrics_write(out, "highscore_shm_ring_invalid_total", "counter", "dropped records of the shared memory ring",
+                  L.shm_ring ? (double) shmring_invalid(L.shm_ring) : 0);
+    metrics_write(out, "highscore_udp_truncated_total", "counter", "udp datagrams dropped, cause they were too large",
+                  (double) atomic_load(&L.udp_truncated));
+    metrics_write(out, "highscore_log_dropped_total", "counter", "log messages dropped by a full async log buffer",
+                  (double) s_log_async_dropped());
+    metrics_write(out, "highscore_log_level", "gauge", "min log level (0=trace, 1=debug, 2=info, 3=warn, 4=error)",
+                  (double) s_log_get_min_level());
+
+    struct MHD_Response *response = MHD_create_response_from_buffer(out->size, out->data, MHD_RESPMEM_MUST_COPY);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4");
+
+    int ret = http_queue_response(connection, MHD_HTTP_OK, response);
+    if (!ret)
+        s_log("http_send_metrics failed to queue response");
+    MHD_destroy_response(response);
+    s_string_kill(&out);
+    return ret;
+}
+
+// MHD_RequestCompletedCallback
+static void http_completed(void *cls, struct MHD_Connection *connection, void **ptr,
+                           enum MHD_RequestTerminationCode toe) {
+    metrics_request_end(toe == MHD_REQUEST_TERMINATED_COMPLETED_OK);
+}
+
+// MHD_NotifyConnectionCallback
+static void http_connection(void *cls, struct MHD_Connection *connection, void **socket_context,
+                            enum MHD_ConnectionNotificationCode toe) {
+    if (toe == MHD_CONNECTION_NOTIFY_STARTED)
+        metrics_connection_started();
+    else if (toe == MHD_CONNECTION_NOTIFY_CLOSED)
+        metrics_connection_closed();
+}
+
 // the ubuntu server is ok with int, but wsl needs HMD_RESULT?
 #ifdef DEBUG_MODE
 static enum MHD_Result
@@ -370,61 +714,105 @@ static int
                         const char *method,
                         const char *version,
                         const char *upload_data, size_t *upload_data_size, void **ptr) {
-    s_log("http_request: %s, method: %s", url, method);
+    s_log_debug("http_request: %s, method: %s", url, method);
     sStr_s topic = s_str_eat_str(s_strc(url), s_strc("/api/"));
 
     bool is_pack = s_str_begins_with(topic, s_strc("pack/"));
-
-    if (s_str_empty(topic) || s_str_count(topic, '.') > 0) {
-        s_log("http_request stopped, topic invalid");
-        return MHD_NO;
-    }
-
-    if (topic.size >= HIGHSCORE_TOPIC_MAX_LENGTH) {
-        s_log("http_request stopped, topic to large");
+    bool is_get = strcmp(method, "GET") == 0;
+    bool is_post = strcmp(method, "POST") == 0;
+    bool is_metrics = SERVER_METRICS && is_get && strcmp(url, "/metrics") == 0;
+
+    // first call of a request (a POST is continued with *ptr set)
+    bool first = !*ptr;
+    enum metrics_route route = METRICS_ROUTE_OTHER;
+    if (is_get && !is_metrics)
+        route = is_pack ? METRICS_ROUTE_GET_PACK : METRICS_ROUTE_GET_HIGHSCORE;
+    else if (is_post)
+        route = is_pack ? METRICS_ROUTE_POST_PACK : METRICS_ROUTE_POST_HIGHSCORE;
+    if (first)
+        metrics_request_begin(route);
+
+    if (is_metrics)
+        return http_send_metrics(connection);
+
+    sTimer_s timer = s_timer_new();
+    bool valid = engine_topic_valid(topic);
+    if (first)
+        metrics_stage(METRICS_STAGE_VALIDATE, timer);
+
+    if (!valid) {
+        s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "http_request stopped, topic invalid");
         return MHD_NO;
     }
 
-    if (strcmp(method, "GET") == 0) {
+    if (is_get) {
         // in both cases (Highscore and HighscorePack), just the file is sent back
         return http_send_highscore(connection, topic.data);
     }
 
-    if (strcmp(method, "POST") == 0) {
+    if (is_post) {
         if (!*ptr) {
-            *ptr = (void *) 1;
-            s_log("http_request POST start");
+            *ptr = (void *) POST_STARTED;
+            s_log_debug("http_request POST start");
             if (*upload_data_size > 0) {
-                s_log("http_request POST start failed, got data?");
+                s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "http_request POST start failed, got data?");
                 return MHD_NO;
             }
             // here could be checked for Content-Type == plain/text
 
+            // reject before the upload is decoded
+            if (!http_ratelimit_take(connection, topic.data)) {
+                *ptr = (void *) POST_RATE_LIMITED;
+                return http_send_status(connection, MHD_HTTP_TOO_MANY_REQUESTS, "1");
+            }
+
             // request not finished yet
             return MHD_YES;
         }
 
+        if (*ptr == (void *) POST_RATE_LIMITED) {
+            // rejected, the response is already queued, so just drop the upload
+            *upload_data_size = 0;
+            return MHD_YES;
+        }
+
         if (upload_data) {
-            s_log("http_request POST got data");
+            s_log_debug("http_request POST got data");
+
+            if (*ptr == (void *) POST_SHED) {
+                // response is sent after the upload
+                *upload_data_size = 0;
+                return MHD_YES;
+            }
+
             sString *entry = s_string_new_clone((sStr_s) {(char *) upload_data, *upload_data_size});
             bool ok;
+            bool shed = false;
 
             if(is_pack) {
-                ok = save_pack_entry(topic, s_string_get_str(entry));
+                ok = engine_save_pack_entry(topic, s_string_get_str(entry), &shed);
             } else {
-                ok = save_entry(topic, s_string_get_str(entry));
+                ok = engine_save_entry(topic, s_string_get_str(entry), &shed);
             }
             s_string_kill(&entry);
             if (!ok)
                 return MHD_NO;
 
+            if (shed)
+                *ptr = (void *) POST_SHED;
+
             // upload_data_size consumed (this is important!)
             *upload_data_size = 0;
             // request not finished yet
             return MHD_YES;
         }
 
-        s_log("http_request POST end");
+        if (*ptr == (void *) POST_SHED) {
+            s_log_info_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "http_request POST shed");
+            return http_send_status(connection, MHD_HTTP_SERVICE_UNAVAILABLE, "1");
+        }
+
+        s_log_debug("http_request POST end");
 
         // in both cases (Highscore and HighscorePack), just the file is sent back
         return http_send_highscore(connection, topic.data);
@@ -435,18 +823,221 @@ static int
     return MHD_NO;
 }
 
-int main(int argc, char **argv) {
-    s_log("Server start");
-    struct MHD_Daemon *d = MHD_start_daemon(
+// SIGUSR1 lowers the min log level (more verbose), SIGUSR2 raises it (less verbose)
+static void log_level_signal(int sig) {
+    int level = s_log_get_min_level() + (sig == SIGUSR1 ? -1 : 1);
+    s_log_set_min_level(s_clamp(level, S_LOG_TRACE, S_LOG_WTF));
+}
+
+// handles a single datagram, see UDP API
+static void udp_handle_datagram(sStr_s datagram) {
+    sStr_s topic;
+    sStr_s msg = s_str_eat_until(datagram, '\n', &topic);
+    msg = s_str_eat(msg, 1);  // newline
+
+    if (!engine_topic_valid(topic)) {
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "udp datagram dropped, topic invalid");
+        return;
+    }
+    char topic_c[HIGHSCORE_TOPIC_MAX_LENGTH];
+    s_str_as_c(topic_c, topic);
+
+    if (L.ratelimit_topic && !ratelimit_take(L.ratelimit_topic, ratelimit_key_str(topic_c))) {
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "udp datagram dropped, rate limit exceeded for topic: %s",
+                           topic_c);
+        return;
+    }
+
+    WriterEntry_s add = {.is_pack = s_str_begins_with(topic, s_strc("pack/"))};
+    strcpy(add.topic, topic_c);
+
+    while (!s_str_empty(msg)) {
+        sStr_s line;
+        msg = s_str_eat_until(msg, '\n', &line);
+        msg = s_str_eat(msg, 1);  // newline
+        line = s_str_strip(line, ' ');
+        if (s_str_empty(line))
+            continue;
+
+        // the decode functions need a 0 terminated entry
+        char entry[HIGHSCORE_PACK_MAX_ENTRY_LENGTH];
+        if (line.size >= HIGHSCORE_PACK_MAX_ENTRY_LENGTH)
+            continue;
+        s_str_as_c(entry, line);
+        line.data = entry;
+
+        if (add.is_pack) {
+            add.pack_entry = highscorepack_entry_decode(line);
+            if (add.pack_entry.text[0] == '\0')
+                continue;
+        } else {
+            add.entry = highscore_entry_decode(line);
+            if (add.entry.name[0] == '\0')
+                continue;
+        }
+
+        // fire and forget, the writer batches the entries
+        if (!engine_submit(add, false))
+            return;
+    }
+}
+
+// thread function for the udp listener
+// receives datagrams in batches and saves the valid entries
+static void *udp_listener(void *arg) {
+    sSocketUdp *so = s_socketudp_new_server("0.0.0.0", SERVER_UDP_PORT);
+    if (!s_socketudp_valid(so)) {
+        s_log_error("failed to start the udp listener");
+        return NULL;
+    }
+    s_log("udp listener started on port: %i", SERVER_UDP_PORT);
+
+    static char data[UDP_BATCH_SIZE][UDP_DATAGRAM_MAX_SIZE];
+    sStr_s buffers[UDP_BATCH_SIZE];
+
+    for (;;) {
+        for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+            buffers[i] = (sStr_s) {data[i], UDP_DATAGRAM_MAX_SIZE};
+        }
+        int received = s_socketudp_recv_batch(so, buffers, UDP_BATCH_SIZE);
+        if (received < 0)
+            break;
+        atomic_store(&L.udp_truncated, s_socketudp_truncated(so));
+        for (int i = 0; i < received; i++) {
+            udp_handle_datagram(buffers[i]);
+        }
+    }
+
+    s_log_error("udp listener stopped");
+    s_socketudp_kill(&so);
+    return NULL;
+}
+
+// starts a daemon with the http handlers on the tcp port
+// or on the pre bound listen_fd, if it is not MHD_INVALID_SOCKET (port is ignored then)
+static struct MHD_Daemon *http_start(su16 port, MHD_socket listen_fd) {
+    return MHD_start_daemon(
             0 | MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_THREAD_PER_CONNECTION,
-            SERVER_PORT,
+            port,
             NULL, NULL, &http_request, NULL,
+            MHD_OPTION_LISTEN_SOCKET, listen_fd,
+            MHD_OPTION_NOTIFY_COMPLETED, &http_completed, NULL,
+            MHD_OPTION_NOTIFY_CONNECTION, &http_connection, NULL,
             MHD_OPTION_END);
-    if (!d) {
-        s_log("failed to start the server");
+}
+
+// shmring_record_fn, submits the record to the writer
+// returns false if the writer queue is full, so the record stays in the ring (back pressure)
+// the retry is not counted as shed, nothing is lost
+static bool shm_submit_record(const ShmRingRecord_s *record, void *user_data) {
+    EngineTopic_s topic;
+    if (!engine_topic_open(&topic, record->topic) || topic.is_pack != record->is_pack) {
+        s_log_warn_limited(HIGHSCORE_LOG_LIMIT_PER_SEC, "shm ring record dropped, topic invalid: %s", record->topic);
+        shmring_add_invalid(L.shm_ring);
+        return true;
+    }
+    // shmring_drain already checked the entry (terminated, not empty, checksum)
+    WriterEntry_s add = {.is_pack = topic.is_pack};
+    strcpy(add.topic, topic.topic);
+    if (add.is_pack)
+        add.pack_entry = record->pack_entry;
+    else
+        add.entry = record->entry;
+    return engine_try_submit(add);
+}
+
+// thread function for the shared memory ring
+// drains the records in batches and submits the valid entries
+static void *shm_ring_drainer(void *arg) {
+    for (;;) {
+        int drained = shmring_drain(L.shm_ring, SHM_RING_BATCH_SIZE, shm_submit_record, NULL);
+        if (drained < SHM_RING_BATCH_SIZE)
+            usleep(SHM_RING_IDLE_US);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    s_log_set_min_level(SERVER_LOG_LEVEL);
+    struct sigaction log_level_action = {.sa_handler = log_level_signal, .sa_flags = SA_RESTART};
+    sigemptyset(&log_level_action.sa_mask);
+    sigaction(SIGUSR1, &log_level_action, NULL);
+    sigaction(SIGUSR2, &log_level_action, NULL);
+
+    if (SERVER_LOG_ASYNC && !s_log_async_start(SERVER_LOG_ASYNC_RING_SIZE))
+        s_log_warn("failed to start the async log, logging synchronously");
+
+    s_log("Server start");
+
+    EngineConfig_s engine = {
+            .persist_sync = PERSIST_SYNC,
+            .persist_sync_interval_ms = PERSIST_SYNC_INTERVAL_MS,
+            .persist_flush_interval_ms = PERSIST_FLUSH_INTERVAL_MS,
+            .persist_flush_dirty_max = PERSIST_FLUSH_DIRTY_MAX,
+            .store = TOPICS_STORE,
+            .store_file = TOPICS_STORE_FILE,
+            .memory_budget_mb = TOPICS_MEMORY_BUDGET_MB,
+            .cold_after_s = TOPICS_COLD_AFTER_S,
+            .cold_scan_interval_s = TOPICS_COLD_SCAN_INTERVAL_S,
+            .cold_file = TOPICS_COLD_FILE,
+            .preload_threads = TOPICS_PRELOAD_THREADS,
+            .journal_snapshot_interval_s = JOURNAL_SNAPSHOT_INTERVAL_S,
+            .journal_threads = JOURNAL_THREADS,
+            .queue_depth = ADMISSION_QUEUE_DEPTH
+    };
+    metrics_set_slow_request(SERVER_SLOW_REQUEST_MS / 1000.0);
+    if (!engine_start(&engine)) {
+        s_log("failed to start the engine");
+        exit(EXIT_FAILURE);
+    }
+
+    if (RATELIMIT_IP_PER_SEC > 0)
+        L.ratelimit_ip = ratelimit_new(RATELIMIT_IP_PER_SEC, RATELIMIT_IP_BURST);
+    if (RATELIMIT_TOPIC_PER_SEC > 0)
+        L.ratelimit_topic = ratelimit_new(RATELIMIT_TOPIC_PER_SEC, RATELIMIT_TOPIC_BURST);
+
+    if (SERVER_PORT <= 0 && SERVER_UNIX_SOCKET[0] == '\0') {
+        s_log("neither SERVER_PORT nor SERVER_UNIX_SOCKET set");
         exit(EXIT_FAILURE);
     }
 
+    if (SERVER_PORT > 0) {
+        if (!http_start(SERVER_PORT, MHD_INVALID_SOCKET)) {
+            s_log("failed to start the server");
+            exit(EXIT_FAILURE);
+        }
+        s_log("http server started on port: %i", SERVER_PORT);
+    }
+
+    if (SERVER_UNIX_SOCKET[0] != '\0') {
+        L.unix_server = s_socketserver_new_unix(SERVER_UNIX_SOCKET, SERVER_UNIX_SOCKET_MODE);
+        if (!s_socketserver_valid(L.unix_server)
+            || !http_start(0, s_socketserver_get_fd(L.unix_server))) {
+            s_log("failed to start the server on the unix socket: %s", SERVER_UNIX_SOCKET);
+            exit(EXIT_FAILURE);
+        }
+        s_log("http server started on unix socket: %s", SERVER_UNIX_SOCKET);
+    }
+
+    if (SERVER_SHM_RING_SIZE > 0) {
+        pthread_t shm_thread;
+        L.shm_ring = shmring_open_server(SERVER_SHM_RING_NAME, SERVER_SHM_RING_SIZE);
+        if (!L.shm_ring || pthread_create(&shm_thread, NULL, shm_ring_drainer, NULL) != 0) {
+            s_log_error("failed to start the shared memory ring");
+        } else {
+            pthread_detach(shm_thread);
+        }
+    }
+
+    if (SERVER_UDP_PORT > 0) {
+        pthread_t udp_thread;
+        if (pthread_create(&udp_thread, NULL, udp_listener, NULL) != 0) {
+            s_log_error("failed to start the udp listener thread");
+        } else {
+            pthread_detach(udp_thread);
+        }
+    }
+
 #ifdef DEBUG_MODE
 
     {
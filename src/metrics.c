@@ -0,0 +1,341 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include "s/s.h"
+#include "s/str.h"
+#include "s/time.h"
+#include "metrics.h"
+
+// counters of a single thread
+// only the owning thread writes (except for the retired block, which is protected by the lock)
+typedef struct MetricsThread {
+    atomic_uint_fast64_t requests[METRICS_ROUTES];
+    atomic_uint_fast64_t errors[METRICS_ROUTES];
+    atomic_uint_fast64_t latency_buckets[METRICS_ROUTES][METRICS_LATENCY_BUCKETS + 1];
+    atomic_uint_fast64_t latency_sum_ns[METRICS_ROUTES];
+    atomic_uint_fast64_t counters[METRICS_COUNTERS];
+    atomic_uint_fast64_t lock_waits[METRICS_LOCKS];
+    atomic_uint_fast64_t lock_wait_ns[METRICS_LOCKS];
+    atomic_uint_fast64_t stage_buckets[METRICS_STAGES][METRICS_LATENCY_BUCKETS + 1];
+    atomic_uint_fast64_t stage_sum_ns[METRICS_STAGES];
+
+    // breakdown of the current request (or writer batch), only used by the owning thread
+    MetricsStages_s stages;
+
+    // current request, only used by the owning thread
+    double request_start;
+    enum metrics_route request_route;
+    unsigned int request_status;
+
+    struct MetricsThread *next;
+    struct MetricsThread *prev;
+} MetricsThread;
+
+
+static const char *route_names[METRICS_ROUTES] = {
+        "get_highscore", "get_pack", "post_highscore", "post_pack", "other"
+};
+
+static const char *lock_names[METRICS_LOCKS] = {
+        "topics", "persist"
+};
+
+static const char *stage_names[METRICS_STAGES] = {
+        "validate", "lock_wait", "file_read", "decode", "writer",
+        "insert", "sort", "encode", "file_write", "response"
+};
+
+static const double latency_bounds[METRICS_LATENCY_BUCKETS] = METRICS_LATENCY_BOUNDS;
+
+static struct {
+    // protects the list of thread blocks and the retired block
+    pthread_mutex_t lock;
+    MetricsThread *threads;
+    MetricsThread retired;
+
+    pthread_once_t key_once;
+    pthread_key_t key;
+
+    atomic_int connections;
+    _Atomic double slow_request;
+} L = {PTHREAD_MUTEX_INITIALIZER, .key_once = PTHREAD_ONCE_INIT};
+
+static _Thread_local MetricsThread *tls;
+
+
+// only the owning thread writes, so no locked read modify write is needed
+static void counter_add(atomic_uint_fast64_t *counter, su64 n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static su64 counter_get(atomic_uint_fast64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// adds all counters of from into into (L.lock must be held for a shared block)
+static void block_merge(MetricsThread *into, MetricsThread *from) {
+    for (int r = 0; r < METRICS_ROUTES; r++) {
+        counter_add(&into->requests[r], counter_get(&from->requests[r]));
+        counter_add(&into->errors[r], counter_get(&from->errors[r]));
+        counter_add(&into->latency_sum_ns[r], counter_get(&from->latency_sum_ns[r]));
+        for (int b = 0; b <= METRICS_LATENCY_BUCKETS; b++)
+            counter_add(&into->latency_buckets[r][b], counter_get(&from->latency_buckets[r][b]));
+    }
+    for (int c = 0; c < METRICS_COUNTERS; c++)
+        counter_add(&into->counters[c], counter_get(&from->counters[c]));
+    for (int l = 0; l < METRICS_LOCKS; l++) {
+        counter_add(&into->lock_waits[l], counter_get(&from->lock_waits[l]));
+        counter_add(&into->lock_wait_ns[l], counter_get(&from->lock_wait_ns[l]));
+    }
+    for (int st = 0; st < METRICS_STAGES; st++) {
+        counter_add(&into->stage_sum_ns[st], counter_get(&from->stage_sum_ns[st]));
+        for (int b = 0; b <= METRICS_LATENCY_BUCKETS; b++)
+            counter_add(&into->stage_buckets[st][b], counter_get(&from->stage_buckets[st][b]));
+    }
+}
+
+// returns the histogram bucket of the time
+static int latency_bucket(double seconds) {
+    int bucket = 0;
+    while (bucket < METRICS_LATENCY_BUCKETS && seconds > latency_bounds[bucket])
+        bucket++;
+    return bucket;
+}
+
+// pthread key destructor, moves the counters of an exiting thread into the retired block
+static void thread_exit(void *arg) {
+    MetricsThread *self = arg;
+    pthread_mutex_lock(&L.lock);
+    {
+        block_merge(&L.retired, self);
+        if (self->prev)
+            self->prev->next = self->next;
+        else
+            L.threads = self->next;
+        if (self->next)
+            self->next->prev = self->prev;
+    }
+    pthread_mutex_unlock(&L.lock);
+    s_free(self);
+    tls = NULL;
+}
+
+static void key_create() {
+    pthread_key_create(&L.key, thread_exit);
+}
+
+// returns the block of the calling thread, which is created on first use
+static MetricsThread *thread_block() {
+    if (tls)
+        return tls;
+    pthread_once(&L.key_once, key_create);
+    MetricsThread *self = s_new0(MetricsThread, 1);
+    pthread_mutex_lock(&L.lock);
+    {
+        self->next = L.threads;
+        if (L.threads)
+            L.threads->prev = self;
+        L.threads = self;
+    }
+    pthread_mutex_unlock(&L.lock);
+    pthread_setspecific(L.key, self);
+    tls = self;
+    return self;
+}
+
+static void append_f(sString *out, const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof buf, format, args);
+    va_end(args);
+    s_string_append(out, s_strc(buf));
+}
+
+static void append_header(sString *out, const char *name, const char *type, const char *help) {
+    append_f(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// appends a histogram series with the label, buckets has METRICS_LATENCY_BUCKETS + 1 counts (not cumulative)
+static void append_histogram(sString *out, const char *name, const char *label, const char *value,
+                             atomic_uint_fast64_t *buckets, su64 sum_ns) {
+    su64 cumulative = 0;
+    for (int b = 0; b <= METRICS_LATENCY_BUCKETS; b++) {
+        cumulative += counter_get(&buckets[b]);
+        if (b < METRICS_LATENCY_BUCKETS) {
+            append_f(out, "%s_bucket{%s=\"%s\",le=\"%g\"} %llu\n",
+                     name, label, value, latency_bounds[b], (unsigned long long) cumulative);
+        } else {
+            append_f(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n",
+                     name, label, value, (unsigned long long) cumulative);
+        }
+    }
+    append_f(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value, sum_ns / 1e9);
+    append_f(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long) cumulative);
+}
+
+// logs the breakdown of a slow request
+static void log_slow_request(MetricsThread *self, double latency) {
+    char buf[512];
+    int pos = 0;
+    for (int st = 0; st < METRICS_STAGES && pos < (int) sizeof buf; st++) {
+        if (self->stages.seconds[st] <= 0)
+            continue;
+        pos += snprintf(buf + pos, sizeof buf - pos, " %s=%.3fms",
+                        stage_names[st], self->stages.seconds[st] * 1000);
+    }
+    buf[s_min(pos, (int) sizeof buf - 1)] = '\0';
+    s_log_warn_limited(METRICS_SLOW_LOG_PER_SEC, "slow request %s: %.3fms,%s",
+                       route_names[self->request_route], latency * 1000, pos > 0 ? buf : " no stages");
+}
+
+
+//
+// public
+//
+
+void metrics_add(enum metrics_counter counter, su64 n) {
+    counter_add(&thread_block()->counters[counter], n);
+}
+
+void metrics_lock(pthread_mutex_t *lock, enum metrics_lock which) {
+    if (pthread_mutex_trylock(lock) == 0)
+        return;
+    sTimer_s timer = s_timer_new();
+    pthread_mutex_lock(lock);
+    MetricsThread *self = thread_block();
+    counter_add(&self->lock_waits[which], 1);
+    counter_add(&self->lock_wait_ns[which], (su64) (s_timer_elapsed(timer) * 1e9));
+    metrics_stage(METRICS_STAGE_LOCK_WAIT, timer);
+}
+
+void metrics_stage(enum metrics_stage stage, sTimer_s timer) {
+    double seconds = s_timer_elapsed(timer);
+    MetricsThread *self = thread_block();
+    self->stages.seconds[stage] += seconds;
+    counter_add(&self->stage_buckets[stage][latency_bucket(seconds)], 1);
+    counter_add(&self->stage_sum_ns[stage], (su64) (seconds * 1e9));
+}
+
+MetricsStages_s metrics_stages_take() {
+    MetricsThread *self = thread_block();
+    MetricsStages_s stages = self->stages;
+    memset(&self->stages, 0, sizeof self->stages);
+    return stages;
+}
+
+void metrics_stages_merge(const MetricsStages_s *stages) {
+    MetricsThread *self = thread_block();
+    for (int st = 0; st < METRICS_STAGES; st++)
+        self->stages.seconds[st] += stages->seconds[st];
+}
+
+void metrics_set_slow_request(double seconds) {
+    atomic_store(&L.slow_request, seconds);
+}
+
+void metrics_connection_started() {
+    atomic_fetch_add(&L.connections, 1);
+}
+
+void metrics_connection_closed() {
+    atomic_fetch_sub(&L.connections, 1);
+}
+
+void metrics_request_begin(enum metrics_route route) {
+    MetricsThread *self = thread_block();
+    self->request_start = s_time_monotonic();
+    self->request_route = route;
+    self->request_status = 0;
+    memset(&self->stages, 0, sizeof self->stages);
+}
+
+void metrics_request_status(unsigned int status) {
+    thread_block()->request_status = status;
+}
+
+void metrics_request_end(bool ok) {
+    MetricsThread *self = thread_block();
+    if (self->request_start <= 0)
+        return;
+    double latency = s_time_monotonic() - self->request_start;
+    self->request_start = 0;
+
+    enum metrics_route r = self->request_route;
+    counter_add(&self->requests[r], 1);
+    if (!ok || self->request_status == 0 || self->request_status >= 400)
+        counter_add(&self->errors[r], 1);
+    counter_add(&self->latency_buckets[r][latency_bucket(latency)], 1);
+    counter_add(&self->latency_sum_ns[r], (su64) (latency * 1e9));
+
+    double slow = atomic_load(&L.slow_request);
+    if (slow > 0 && latency >= slow)
+        log_slow_request(self, latency);
+}
+
+sString *metrics_render() {
+    // sum of all threads
+    MetricsThread *sum = s_new0(MetricsThread, 1);
+    pthread_mutex_lock(&L.lock);
+    {
+        block_merge(sum, &L.retired);
+        for (MetricsThread *t = L.threads; t; t = t->next)
+            block_merge(sum, t);
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    sString *out = s_string_new(4096);
+
+    append_header(out, "highscore_http_requests_total", "counter", "HTTP requests by route");
+    for (int r = 0; r < METRICS_ROUTES; r++) {
+        append_f(out, "highscore_http_requests_total{route=\"%s\"} %llu\n",
+                 route_names[r], (unsigned long long) counter_get(&sum->requests[r]));
+    }
+    append_header(out, "highscore_http_request_errors_total", "counter",
+                  "HTTP requests by route, that failed or got a status >= 400");
+    for (int r = 0; r < METRICS_ROUTES; r++) {
+        append_f(out, "highscore_http_request_errors_total{route=\"%s\"} %llu\n",
+                 route_names[r], (unsigned long long) counter_get(&sum->errors[r]));
+    }
+
+    append_header(out, "highscore_http_request_duration_seconds", "histogram",
+                  "HTTP request latency by route, until the response is sent");
+    for (int r = 0; r < METRICS_ROUTES; r++) {
+        append_histogram(out, "highscore_http_request_duration_seconds", "route", route_names[r],
+                         sum->latency_buckets[r], counter_get(&sum->latency_sum_ns[r]));
+    }
+
+    append_header(out, "highscore_stage_duration_seconds", "histogram",
+                  "time of the request stages, the writer stage contains insert, sort, encode and file_write");
+    for (int st = 0; st < METRICS_STAGES; st++) {
+        append_histogram(out, "highscore_stage_duration_seconds", "stage", stage_names[st],
+                         sum->stage_buckets[st], counter_get(&sum->stage_sum_ns[st]));
+    }
+
+    metrics_write(out, "highscore_http_connections_in_flight", "gauge",
+                  "open HTTP connections", atomic_load(&L.connections));
+    metrics_write(out, "highscore_file_read_bytes_total", "counter",
+                  "bytes read from topic files, the store and the cold archive",
+                  (double) counter_get(&sum->counters[METRICS_FILE_READ_BYTES]));
+    metrics_write(out, "highscore_file_write_bytes_total", "counter",
+                  "bytes written into topic files and the store",
+                  (double) counter_get(&sum->counters[METRICS_FILE_WRITE_BYTES]));
+
+    append_header(out, "highscore_lock_waits_total", "counter", "lock acquisitions, that had to wait");
+    for (int l = 0; l < METRICS_LOCKS; l++) {
+        append_f(out, "highscore_lock_waits_total{lock=\"%s\"} %llu\n",
+                 lock_names[l], (unsigned long long) counter_get(&sum->lock_waits[l]));
+    }
+    append_header(out, "highscore_lock_wait_seconds_total", "counter", "time spent waiting for locks");
+    for (int l = 0; l < METRICS_LOCKS; l++) {
+        append_f(out, "highscore_lock_wait_seconds_total{lock=\"%s\"} %.9f\n",
+                 lock_names[l], counter_get(&sum->lock_wait_ns[l]) / 1e9);
+    }
+
+    s_free(sum);
+    return out;
+}
+
+void metrics_write(sString *out, const char *name, const char *type, const char *help, double value) {
+    append_header(out, name, type, help);
+    append_f(out, "%s %.17g\n", name, value);
+}
@@ -0,0 +1,111 @@
+#ifndef HIGHSCORESERVER_METRICS_H
+#define HIGHSCORESERVER_METRICS_H
+
+//
+// Prometheus style metrics
+//      each thread counts into its own block of counters (no shared cache lines, no locked instructions)
+//      the blocks are only aggregated, when the metrics are rendered (scraped)
+//      counters of an exited thread are moved into a retired block
+//      a request is measured from metrics_request_begin to metrics_request_end
+//      (MHD calls all callbacks of a connection from the same thread)
+//      the stages of a request (validate, decode, file read, ...) are timed with metrics_stage
+//      into per stage histograms and into a breakdown of the current request of the thread
+//      a slow request (see metrics_set_slow_request) logs its breakdown
+//
+
+#include <pthread.h>
+#include "s/s.h"
+#include "s/string.h"
+#include "s/time.h"
+
+// upper bounds in seconds of the request latency histogram buckets (+Inf is added)
+#define METRICS_LATENCY_BUCKETS 12
+#define METRICS_LATENCY_BOUNDS {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.5, 1.0}
+
+// max logged slow requests per second (an overloaded server is slow for every request)
+#define METRICS_SLOW_LOG_PER_SEC 10
+
+enum metrics_route {
+    METRICS_ROUTE_GET_HIGHSCORE,
+    METRICS_ROUTE_GET_PACK,
+    METRICS_ROUTE_POST_HIGHSCORE,
+    METRICS_ROUTE_POST_PACK,
+    METRICS_ROUTE_OTHER,
+    METRICS_ROUTES
+};
+
+enum metrics_counter {
+    METRICS_FILE_READ_BYTES,
+    METRICS_FILE_WRITE_BYTES,
+    METRICS_COUNTERS
+};
+
+// locks, which wait time is measured with metrics_lock
+enum metrics_lock {
+    METRICS_LOCK_TOPICS,
+    METRICS_LOCK_PERSIST,
+    METRICS_LOCKS
+};
+
+enum metrics_stage {
+    METRICS_STAGE_VALIDATE,
+    METRICS_STAGE_LOCK_WAIT,
+    METRICS_STAGE_FILE_READ,
+    METRICS_STAGE_DECODE,
+    // waiting for the writer to apply an entry, contains the writer stages (insert, sort, encode, ...)
+    METRICS_STAGE_WRITER,
+    METRICS_STAGE_INSERT,
+    METRICS_STAGE_SORT,
+    METRICS_STAGE_ENCODE,
+    METRICS_STAGE_FILE_WRITE,
+    METRICS_STAGE_RESPONSE,
+    METRICS_STAGES
+};
+
+// time in seconds of each stage
+typedef struct {
+    double seconds[METRICS_STAGES];
+} MetricsStages_s;
+
+// adds n to the counter of the calling thread
+void metrics_add(enum metrics_counter counter, su64 n);
+
+// locks the mutex and measures the wait time, if it is locked by another thread
+void metrics_lock(pthread_mutex_t *lock, enum metrics_lock which);
+
+// adds the elapsed time of the timer to the stage histogram and the breakdown of the calling thread
+void metrics_stage(enum metrics_stage stage, sTimer_s timer);
+
+// returns and clears the breakdown of the calling thread
+// used by the writer to pass the breakdown of a batch to the waiting requests
+MetricsStages_s metrics_stages_take();
+
+// adds the breakdown of another thread to the breakdown of the calling thread (not to the histograms)
+void metrics_stages_merge(const MetricsStages_s *stages);
+
+// requests slower than seconds log their breakdown, <=0 to disable
+void metrics_set_slow_request(double seconds);
+
+// called on a new (MHD_CONNECTION_NOTIFY_STARTED) and a closed connection
+void metrics_connection_started();
+void metrics_connection_closed();
+
+// starts a request of the calling thread
+void metrics_request_begin(enum metrics_route route);
+
+// sets the status code of the response of the current request of the calling thread
+void metrics_request_status(unsigned int status);
+
+// ends the current request of the calling thread and counts it
+// the request is an error, if ok is false, no status was set or the status is >= 400
+void metrics_request_end(bool ok);
+
+// returns all metrics in the prometheus text format
+// the caller may append more with metrics_write
+sString *metrics_render();
+
+// appends a metric with a single value in the prometheus text format
+// type is "counter" or "gauge"
+void metrics_write(sString *out, const char *name, const char *type, const char *help, double value);
+
+#endif //HIGHSCORESERVER_METRICS_H
@@ -0,0 +1,453 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "s/s.h"
+#include "s/file.h"
+#include "s/time.h"
+#include "highscore.h"
+#include "persist.h"
+#include "store.h"
+#include "metrics.h"
+
+typedef struct {
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+    sString *encoded;
+} PersistTopic_s;
+
+#define TYPE PersistTopic_s
+#define CLASS PersistRound
+#define FN_NAME persist_round
+
+#include "s/dynarray.h"
+
+// dirty topic -> index+1 into the dirty round
+#define TYPE ssize
+#define CLASS PersistDirtyMap
+#define FN_NAME persist_dirty_map
+
+#include "s/hashmap_string.h"
+
+// buckets of the dirty map
+#define PERSIST_DIRTY_MAP_SIZE 4096
+
+
+static struct {
+    enum persist_sync sync;
+    double sync_interval;
+    double flush_interval;
+    int flush_dirty_max;
+
+    // dirty topics, protected by lock
+    pthread_mutex_t lock;
+    pthread_cond_t flush_cond;
+    PersistRound dirty;
+    PersistDirtyMap dirty_map;
+
+    // topics taken from dirty, until they are written
+    PersistDirtyMap flushing_map;
+
+    // only used by the flushing thread (the writer for write through, else the flush thread)
+    PersistRound flushing;
+    int unsynced;   // files written since the last sync
+
+    // topic files renamed since the last sync (PERSIST_SYNC_INTERVAL), topic -> index+1
+    PersistRound unsynced_topics;
+    PersistDirtyMap unsynced_map;
+    double last_sync_time;
+
+    atomic_uint_fast64_t flushed;
+    atomic_uint_fast64_t coalesced;
+} L = {.lock = PTHREAD_MUTEX_INITIALIZER, .flush_cond = PTHREAD_COND_INITIALIZER};
+
+
+static void topic_file_paths(const char *topic, char *file, char *tmp) {
+    snprintf(file, 256, "topics/%s.txt", topic);
+    snprintf(tmp, 256 + 8, "topics/%s.txt.tmp", topic);
+}
+
+// writes the directory of the topic file into dir
+static void topic_file_dir(const char *topic, char *dir) {
+    snprintf(dir, 256, "topics/%s", topic);
+    *strrchr(dir, '/') = '\0';
+}
+
+// syncs a file or directory with fsync
+static bool sync_path(const char *path, bool dir) {
+    int fd = open(path, dir ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+    bool ok = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+    return ok;
+}
+
+typedef struct {
+    char path[256];
+} PersistDir_s;
+
+static int dir_compare(const void *a, const void *b) {
+    return strcmp(((const PersistDir_s *) a)->path, ((const PersistDir_s *) b)->path);
+}
+
+// syncs the directories of the topic files (so their renames), each directory only once
+static void sync_dirs(const PersistRound *topics) {
+    if (topics->size == 0)
+        return;
+    PersistDir_s *dirs = s_new(PersistDir_s, topics->size);
+    for (ssize i = 0; i < topics->size; i++) {
+        topic_file_dir(topics->array[i].topic, dirs[i].path);
+    }
+    qsort(dirs, topics->size, sizeof *dirs, dir_compare);
+    for (ssize i = 0; i < topics->size; i++) {
+        if (i > 0 && strcmp(dirs[i].path, dirs[i - 1].path) == 0)
+            continue;
+        if (!sync_path(dirs[i].path, true))
+            s_log_error("failed to sync the topic directory: %s", dirs[i].path);
+    }
+    s_free(dirs);
+}
+
+// writes the topic into its temp file, the topic file is replaced later by topic_file_replace
+// if sync is true, the temp file is synced before it is closed
+static bool topic_file_write_tmp(const char *topic, sStr_s content, bool sync) {
+    char file[256], tmp[256 + 8];
+    topic_file_paths(topic, file, tmp);
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f && errno == ENOENT) {
+        // first write of the topic, so create its directories (only then, to not call mkdir on each write)
+        char dir[256];
+        topic_file_dir(topic, dir);
+        persist_make_dirs(dir);
+        f = fopen(tmp, "wb");
+    }
+    if (!f)
+        return false;
+    bool ok = (ssize) fwrite(content.data, 1, content.size, f) == content.size && fflush(f) == 0;
+    if (ok && sync)
+        ok = fsync(fileno(f)) == 0;
+    fclose(f);
+    if (ok)
+        metrics_add(METRICS_FILE_WRITE_BYTES, content.size);
+    return ok;
+}
+
+// renames the temp file over the topic file
+// so readers, which open the topic file without a lock, never see a partial topic
+static bool topic_file_replace(const char *topic) {
+    char file[256], tmp[256 + 8];
+    topic_file_paths(topic, file, tmp);
+
+    if (rename(tmp, file) != 0) {
+        s_log_error("failed to rename the temp topic file: %s", tmp);
+        return false;
+    }
+    return true;
+}
+
+// remembers a renamed topic file for the next interval sync
+static void unsynced_add(const char *topic) {
+    L.unsynced++;
+    ssize *index = persist_dirty_map_get(&L.unsynced_map, topic);
+    if (*index > 0)
+        return;
+    PersistTopic_s add = {0};
+    snprintf(add.topic, sizeof add.topic, "%s", topic);
+    persist_round_push(&L.unsynced_topics, add);
+    *index = L.unsynced_topics.size;
+}
+
+// syncs the topic files renamed since the last sync and their directories
+// (fsync of each file, not syncfs, which would sync all dirty files of the file system)
+// or syncs the store file, which releases the old records of the written topics
+static void sync_renames() {
+    double start = s_time_monotonic();
+    if (store_enabled()) {
+        store_commit(true);
+    } else {
+        for (ssize i = 0; i < L.unsynced_topics.size; i++) {
+            const char *topic = L.unsynced_topics.array[i].topic;
+            char file[256], tmp[256 + 8];
+            topic_file_paths(topic, file, tmp);
+            if (!sync_path(file, false))
+                s_log_error("failed to sync the topic file: %s", file);
+            persist_dirty_map_remove(&L.unsynced_map, topic);
+        }
+        sync_dirs(&L.unsynced_topics);
+        L.unsynced_topics.size = 0;
+    }
+    s_log("synced %i topic files in %.3f ms", L.unsynced, (s_time_monotonic() - start) * 1000.0);
+    L.unsynced = 0;
+    L.last_sync_time = s_time_monotonic();
+}
+
+
+// syncs if the sync interval has elapsed and topics were written since the last sync
+static void sync_tick() {
+    if (L.sync != PERSIST_SYNC_INTERVAL || L.unsynced == 0)
+        return;
+    if (s_time_monotonic() - L.last_sync_time >= L.sync_interval)
+        sync_renames();
+}
+
+// removes the written topics of L.flushing from the flushing map
+static void flushed_clear() {
+    metrics_lock(&L.lock, METRICS_LOCK_PERSIST);
+    {
+        for (ssize i = 0; i < L.flushing.size; i++) {
+            persist_dirty_map_remove(&L.flushing_map, L.flushing.array[i].topic);
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+    L.flushing.size = 0;
+}
+
+// moves the dirty topics into L.flushing, so they can be written without holding the lock
+static void take_dirty() {
+    metrics_lock(&L.lock, METRICS_LOCK_PERSIST);
+    {
+        PersistRound swap = L.flushing;
+        L.flushing = L.dirty;
+        L.dirty = swap;
+        for (ssize i = 0; i < L.flushing.size; i++) {
+            persist_dirty_map_remove(&L.dirty_map, L.flushing.array[i].topic);
+            *persist_dirty_map_get(&L.flushing_map, L.flushing.array[i].topic) = 1;
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+}
+
+// writes all topics of L.flushing into the store
+// the store keeps the old records until they are synced, so the sync is not needed before
+static void flush_store() {
+    int written = 0;
+    for (ssize i = 0; i < L.flushing.size; i++) {
+        PersistTopic_s *t = &L.flushing.array[i];
+        if (!store_write(t->topic, s_string_get_str(t->encoded))) {
+            s_log("failed to save topic into the store: %s", t->topic);
+        } else {
+            written++;
+            metrics_add(METRICS_FILE_WRITE_BYTES, t->encoded->size);
+        }
+        s_string_kill(&t->encoded);
+    }
+    s_log("%i highscores saved into the store", written);
+    atomic_fetch_add(&L.flushed, written);
+    L.unsynced += written;
+
+    if (L.sync == PERSIST_SYNC_NEVER) {
+        store_commit(false);
+        L.unsynced = 0;
+    } else if (L.sync == PERSIST_SYNC_ALWAYS) {
+        sync_renames();
+    } else {
+        sync_tick();
+    }
+}
+
+// writes all topics of L.flushing
+// crash safety:
+//      1. all temp files of the round are written (and synced for PERSIST_SYNC_ALWAYS)
+//      2. the temp files are renamed over the topic files
+//      3. PERSIST_SYNC_ALWAYS: the directories of the renames are synced
+//         PERSIST_SYNC_INTERVAL: the topic files and their directories are synced with the next interval sync
+// so after a crash, a topic file is either the old or the new complete version, never a partial one
+// (PERSIST_SYNC_INTERVAL only, if the file system orders the rename after the data, like ext4 and xfs do for
+// a rename over an existing file, else a topic file renamed within the last interval may be partial)
+static void flush() {
+    if (L.flushing.size == 0)
+        return;
+
+    sTimer_s timer = s_timer_new();
+    if (store_enabled()) {
+        flush_store();
+        metrics_stage(METRICS_STAGE_FILE_WRITE, timer);
+        return;
+    }
+
+    bool sync = L.sync == PERSIST_SYNC_ALWAYS;
+    int written = 0;
+    for (ssize i = 0; i < L.flushing.size; i++) {
+        PersistTopic_s *t = &L.flushing.array[i];
+        if (!topic_file_write_tmp(t->topic, s_string_get_str(t->encoded), sync)) {
+            s_log("failed to save topic file: %s", t->topic);
+        } else if (topic_file_replace(t->topic)) {
+            s_log_debug("new highscore saved");
+            written++;
+            if (L.sync == PERSIST_SYNC_INTERVAL)
+                unsynced_add(t->topic);
+        }
+        s_string_kill(&t->encoded);
+    }
+    atomic_fetch_add(&L.flushed, written);
+
+    if (sync && written > 0) {
+        sTimer_s sync_timer = s_timer_new();
+        sync_dirs(&L.flushing);
+        s_log_debug("synced %i topic files in %.3f ms", written, s_timer_elapsed(sync_timer) * 1000.0);
+    } else {
+        sync_tick();
+    }
+    metrics_stage(METRICS_STAGE_FILE_WRITE, timer);
+}
+
+// write behind, flushes the dirty topics every flush_interval or if flush_dirty_max topics are dirty
+static void *flush_thread(void *arg) {
+    for (;;) {
+        metrics_lock(&L.lock, METRICS_LOCK_PERSIST);
+        {
+            double until = s_time_monotonic() + L.flush_interval;
+            while (L.dirty.size < L.flush_dirty_max) {
+                double remaining = until - s_time_monotonic();
+                // also wake up for an interval sync
+                if (L.sync == PERSIST_SYNC_INTERVAL && L.unsynced > 0)
+                    remaining = s_min(remaining, L.sync_interval - (s_time_monotonic() - L.last_sync_time));
+                if (remaining <= 0)
+                    break;
+
+                // the cond uses CLOCK_REALTIME by default
+                struct timespec abs;
+                clock_gettime(CLOCK_REALTIME, &abs);
+                long long ns = abs.tv_nsec + (long long) (remaining * 1e9);
+                abs.tv_sec += (time_t) (ns / 1000000000LL);
+                abs.tv_nsec = (long) (ns % 1000000000LL);
+                if (pthread_cond_timedwait(&L.flush_cond, &L.lock, &abs) == ETIMEDOUT)
+                    break;
+            }
+        }
+        pthread_mutex_unlock(&L.lock);
+
+        take_dirty();
+        flush();
+        flushed_clear();
+        sync_tick();
+    }
+    return NULL;
+}
+
+
+//
+// public
+//
+
+void persist_make_dirs(const char *dir) {
+    char path[256];
+    snprintf(path, sizeof path, "%s", dir);
+    for (char *c = path + 1; *c; c++) {
+        if (*c != '/')
+            continue;
+        *c = '\0';
+        mkdir(path, 0755);
+        *c = '/';
+    }
+    if (mkdir(path, 0755) != 0 && errno != EEXIST)
+        s_log_error("failed to create the directory: %s", path);
+}
+
+bool persist_init(enum persist_sync sync, int sync_interval_ms, int flush_interval_ms, int flush_dirty_max) {
+    L.sync = sync;
+    L.sync_interval = sync_interval_ms / 1000.0;
+    L.flush_interval = flush_interval_ms / 1000.0;
+    L.flush_dirty_max = s_max(1, flush_dirty_max);
+    L.dirty = persist_round_new(32);
+    L.flushing = persist_round_new(32);
+    L.dirty_map = persist_dirty_map_new(PERSIST_DIRTY_MAP_SIZE);
+    L.flushing_map = persist_dirty_map_new(PERSIST_DIRTY_MAP_SIZE);
+    L.unsynced_topics = persist_round_new(32);
+    L.unsynced_map = persist_dirty_map_new(PERSIST_DIRTY_MAP_SIZE);
+    L.last_sync_time = s_time_monotonic();
+    atomic_init(&L.flushed, 0);
+    atomic_init(&L.coalesced, 0);
+
+    if (flush_interval_ms <= 0)
+        return true;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, flush_thread, NULL) != 0) {
+        s_log_error("persist_init failed to create the flush thread");
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+void persist_add(const char *topic, sString *encoded) {
+    bool flush_now;
+    metrics_lock(&L.lock, METRICS_LOCK_PERSIST);
+    {
+        // a later version of a dirty topic replaces the old one (coalesced into a single write)
+        ssize *index = persist_dirty_map_get(&L.dirty_map, topic);
+        if (*index > 0) {
+            s_string_kill(&L.dirty.array[*index - 1].encoded);
+            L.dirty.array[*index - 1].encoded = encoded;
+            atomic_fetch_add(&L.coalesced, 1);
+        } else {
+            PersistTopic_s add = {.encoded = encoded};
+            snprintf(add.topic, sizeof add.topic, "%s", topic);
+            persist_round_push(&L.dirty, add);
+            *index = L.dirty.size;
+        }
+        flush_now = L.dirty.size >= L.flush_dirty_max;
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    if (flush_now && L.flush_interval > 0)
+        pthread_cond_signal(&L.flush_cond);
+}
+
+void persist_commit() {
+    // write behind, the flush thread writes the topics
+    if (L.flush_interval > 0)
+        return;
+
+    take_dirty();
+    flush();
+    flushed_clear();
+}
+
+void persist_flush() {
+    take_dirty();
+    flush();
+    flushed_clear();
+    if (L.sync != PERSIST_SYNC_NEVER && L.unsynced > 0)
+        sync_renames();
+}
+
+void persist_tick() {
+    if (L.flush_interval > 0)
+        return;
+    sync_tick();
+}
+
+int persist_tick_timeout_ms() {
+    if (L.flush_interval > 0 || L.sync != PERSIST_SYNC_INTERVAL || L.unsynced == 0)
+        return -1;
+    double remaining = L.sync_interval - (s_time_monotonic() - L.last_sync_time);
+    return (int) s_max(0, remaining * 1000.0 + 1);
+}
+
+bool persist_clean(const char *topic) {
+    bool dirty;
+    metrics_lock(&L.lock, METRICS_LOCK_PERSIST);
+    {
+        ssize *index = persist_dirty_map_get(&L.dirty_map, topic);
+        ssize *flushing = persist_dirty_map_get(&L.flushing_map, topic);
+        dirty = *index > 0 || *flushing > 0;
+        if (*index == 0)
+            persist_dirty_map_remove(&L.dirty_map, topic);
+        if (*flushing == 0)
+            persist_dirty_map_remove(&L.flushing_map, topic);
+    }
+    pthread_mutex_unlock(&L.lock);
+    return !dirty;
+}
+
+su64 persist_flushed() {
+    return atomic_load(&L.flushed);
+}
+
+su64 persist_coalesced() {
+    return atomic_load(&L.coalesced);
+}
@@ -0,0 +1,75 @@
+#ifndef HIGHSCORESERVER_PERSIST_H
+#define HIGHSCORESERVER_PERSIST_H
+
+//
+// Persistence of the topic files
+//      the writer marks each changed topic dirty with its encoded data
+//      multiple updates of a dirty topic are coalesced into a single write
+//      write through (flush_interval_ms <= 0):
+//          persist_commit writes all dirty topics of a writer batch, before its entries are acknowledged
+//          (durable on acknowledge only with PERSIST_SYNC_ALWAYS)
+//      write behind (flush_interval_ms > 0):
+//          a flush thread writes the dirty topics every flush_interval_ms
+//          or as soon as flush_dirty_max topics are dirty
+//          entries are acknowledged when applied in memory, so before they are written or synced
+//      PERSIST_SYNC_ALWAYS syncs each written temp file and, once per flush, the directories of the renames
+//      PERSIST_SYNC_INTERVAL syncs the topic files written since the last sync every sync_interval_ms
+//      (fsync of the written files only, so other files on the file system, like the journal, are not synced)
+//      topic files are replaced with a rename of a synced temp file,
+//      so readers need no lock and a crash never leaves a partial topic file
+//
+
+#include "s/s.h"
+#include "s/string.h"
+
+enum persist_sync {
+    // never sync, the os decides when the topic files are written to the disk
+    // (a crash may leave partial topic files)
+    PERSIST_SYNC_NEVER,
+
+    // sync the written topic files every sync_interval_ms (entries may be lost within that interval)
+    PERSIST_SYNC_INTERVAL,
+
+    // sync each flush, before its topics are replaced
+    PERSIST_SYNC_ALWAYS
+};
+
+// creates the directory dir and its parents (like mkdir -p)
+void persist_make_dirs(const char *dir);
+
+// sets the sync policy, sync_interval_ms is used for PERSIST_SYNC_INTERVAL
+// starts the flush thread, if flush_interval_ms > 0 (write behind)
+bool persist_init(enum persist_sync sync, int sync_interval_ms, int flush_interval_ms, int flush_dirty_max);
+
+// marks the topic dirty with its encoded data and takes ownership of encoded
+// a later version of a dirty topic replaces the old one
+// topic must be 0 terminated!
+void persist_add(const char *topic, sString *encoded);
+
+// called by the writer after each batch
+// writes all dirty topics for write through, else noop
+void persist_commit();
+
+// syncs if the sync interval has elapsed and topics were written since the last sync
+// should be called periodically by the writer for PERSIST_SYNC_INTERVAL (see persist_tick_timeout_ms)
+void persist_tick();
+
+// returns the time in ms until persist_tick should be called, or -1 if not needed
+int persist_tick_timeout_ms();
+
+// writes all dirty topics on the calling thread and syncs them (except for PERSIST_SYNC_NEVER)
+// used by the journal, which writes the topic files with its snapshots
+// (so neither the writer nor a flush thread may flush, see writer.c and engine_start)
+void persist_flush();
+
+// returns true if the topic is written (not dirty and not in a running flush)
+// topic must be 0 terminated!
+bool persist_clean(const char *topic);
+
+// returns the number of written topic files
+su64 persist_flushed();
+
+// returns the number of topic updates, that were coalesced into the write of a dirty topic
+su64 persist_coalesced();
+
+#endif //HIGHSCORESERVER_PERSIST_H
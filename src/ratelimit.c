@@ -0,0 +1,117 @@
+#include <pthread.h>
+#include "s/s.h"
+#include "s/time.h"
+#include "ratelimit.h"
+
+// shards with their own lock, selected by the key
+#define RATELIMIT_SHARDS 64
+
+// buckets per shard
+#define RATELIMIT_SHARD_SIZE 1024
+
+// buckets that are probed for a key, before the least recently used is reused
+#define RATELIMIT_PROBES 8
+
+typedef struct {
+    su64 key;     // 0 = empty
+    double tokens;
+    double last_time;
+} RateLimitBucket_s;
+
+typedef struct {
+    pthread_mutex_t lock;
+    RateLimitBucket_s buckets[RATELIMIT_SHARD_SIZE];
+} RateLimitShard_s;
+
+struct RateLimit {
+    double per_sec;
+    double burst;
+    atomic_uint_fast64_t rejected;
+    RateLimitShard_s shards[RATELIMIT_SHARDS];
+};
+
+
+//
+// public
+//
+
+RateLimit *ratelimit_new(double per_sec, double burst) {
+    RateLimit *self = s_new0(RateLimit, 1);
+    self->per_sec = per_sec;
+    self->burst = s_max(burst, 1);
+    atomic_init(&self->rejected, 0);
+    for (int i = 0; i < RATELIMIT_SHARDS; i++) {
+        pthread_mutex_init(&self->shards[i].lock, NULL);
+    }
+    return self;
+}
+
+void ratelimit_kill(RateLimit **self_ptr) {
+    RateLimit *self = *self_ptr;
+    if (!self)
+        return;
+    for (int i = 0; i < RATELIMIT_SHARDS; i++) {
+        pthread_mutex_destroy(&self->shards[i].lock);
+    }
+    s_free(self);
+    *self_ptr = NULL;
+}
+
+bool ratelimit_take(RateLimit *self, su64 key) {
+    double now = s_time_monotonic();
+
+    // upper bits select the shard, lower bits the bucket
+    RateLimitShard_s *shard = &self->shards[(key >> 48) % RATELIMIT_SHARDS];
+    su64 start = key % RATELIMIT_SHARD_SIZE;
+
+    bool ok;
+    pthread_mutex_lock(&shard->lock);
+    {
+        RateLimitBucket_s *bucket = NULL;
+        RateLimitBucket_s *lru = NULL;
+        for (int i = 0; i < RATELIMIT_PROBES; i++) {
+            RateLimitBucket_s *b = &shard->buckets[(start + i) % RATELIMIT_SHARD_SIZE];
+            if (b->key == key) {
+                bucket = b;
+                break;
+            }
+            if (!lru || b->key == 0 || (lru->key != 0 && b->last_time < lru->last_time))
+                lru = b;
+        }
+
+        if (!bucket) {
+            // new key, starts with a full bucket
+            bucket = lru;
+            bucket->key = key;
+            bucket->tokens = self->burst;
+        } else {
+            bucket->tokens = s_min(self->burst, bucket->tokens + (now - bucket->last_time) * self->per_sec);
+        }
+        bucket->last_time = now;
+
+        ok = bucket->tokens >= 1.0;
+        if (ok)
+            bucket->tokens -= 1.0;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (!ok)
+        atomic_fetch_add(&self->rejected, 1);
+    return ok;
+}
+
+su64 ratelimit_rejected(const RateLimit *self) {
+    return atomic_load(&self->rejected);
+}
+
+su64 ratelimit_key(const void *data, ssize size) {
+    // fnv-1a
+    su64 hash = 14695981039346656037ULL;
+    const su8 *bytes = data;
+    for (ssize i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    // 0 is reserved for empty buckets
+    return hash ? hash : 1;
+}
@@ -0,0 +1,36 @@
+#ifndef HIGHSCORESERVER_RATELIMIT_H
+#define HIGHSCORESERVER_RATELIMIT_H
+
+//
+// Token bucket rate limiting
+//      each key (client ip, topic, ...) has its own bucket, which refills with per_sec tokens per second
+//      the buckets are stored in a fixed size sharded hash table, so memory is bounded
+//      if the table is full, the bucket that was least recently used is reused
+//
+
+#include <stdatomic.h>
+#include "s/s.h"
+
+typedef struct RateLimit RateLimit;
+
+// creates a new rate limit with per_sec tokens per second and up to burst tokens per key
+RateLimit *ratelimit_new(double per_sec, double burst);
+
+void ratelimit_kill(RateLimit **self_ptr);
+
+// takes a token for the key
+// returns false if the bucket of the key is empty, so the request should be rejected
+bool ratelimit_take(RateLimit *self, su64 key);
+
+// returns the number of rejected takes
+su64 ratelimit_rejected(const RateLimit *self);
+
+// creates a key from memory (for example an ip address)
+su64 ratelimit_key(const void *data, ssize size);
+
+// creates a key from a 0 terminated string (for example a topic)
+static su64 ratelimit_key_str(const char *str) {
+    return ratelimit_key(str, (ssize) strlen(str));
+}
+
+#endif //HIGHSCORESERVER_RATELIMIT_H
@@ -0,0 +1,5 @@
+//
+// implementation of the s library (header only), compiled once into libhighscore
+//
+
+#include "s/s_impl.h"
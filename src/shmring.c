@@ -0,0 +1,234 @@
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "s/s.h"
+#include "shmring.h"
+
+// protected functions:
+
+uint64_t highscore_entry_get_checksum(HighscoreEntry_s self);
+
+uint64_t highscorepack_entry_get_checksum(HighscorePackEntry_s self);
+
+
+struct ShmRing {
+    ShmRingHeader_s *header;
+    ShmRingRecord_s *records;
+    su64 mask;
+    ssize size;
+
+    // server only
+    atomic_uint_fast64_t invalid;
+};
+
+static ssize segment_size(su32 capacity) {
+    return (ssize) sizeof(ShmRingHeader_s) + (ssize) capacity * (ssize) sizeof(ShmRingRecord_s);
+}
+
+static ShmRing *ring_map(int fd, ssize size) {
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    ShmRing *self = s_new0(ShmRing, 1);
+    self->header = map;
+    self->records = (ShmRingRecord_s *) ((char *) map + sizeof(ShmRingHeader_s));
+    self->size = size;
+    return self;
+}
+
+// returns true if the mapped header is valid for the mapped size
+static bool ring_compatible(ShmRing *self) {
+    ShmRingHeader_s *h = self->header;
+    if (memcmp(h->magic, SHMRING_MAGIC, sizeof h->magic) != 0
+        || h->record_size != sizeof(ShmRingRecord_s)
+        || h->capacity == 0 || (h->capacity & (h->capacity - 1)) != 0
+        || segment_size(h->capacity) != self->size)
+        return false;
+    atomic_thread_fence(memory_order_acquire);
+    self->mask = h->capacity - 1;
+    return true;
+}
+
+static bool push(ShmRing *self, const ShmRingRecord_s *record) {
+    ShmRingHeader_s *h = self->header;
+    su64 pos = atomic_load_explicit(&h->head, memory_order_relaxed);
+    for (;;) {
+        ShmRingRecord_s *slot = &self->records[pos & self->mask];
+        su64 seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&h->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->checksum = record->checksum;
+                slot->is_pack = record->is_pack;
+                memcpy(slot->topic, record->topic, sizeof slot->topic);
+                if (record->is_pack)
+                    slot->pack_entry = record->pack_entry;
+                else
+                    slot->entry = record->entry;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return true;
+            }
+            // pos was reloaded by the failed cas
+        } else if (seq < pos) {
+            // the slot of the last round was not drained yet
+            return false;
+        } else {
+            pos = atomic_load_explicit(&h->head, memory_order_relaxed);
+        }
+    }
+}
+
+static bool record_valid(const ShmRingRecord_s *r) {
+    if (!memchr(r->topic, '\0', sizeof r->topic) || r->topic[0] == '\0')
+        return false;
+    if (r->is_pack) {
+        return memchr(r->pack_entry.text, '\0', sizeof r->pack_entry.text)
+               && r->pack_entry.text[0] != '\0'
+               && highscorepack_entry_get_checksum(r->pack_entry) == r->checksum;
+    }
+    return memchr(r->entry.name, '\0', sizeof r->entry.name)
+           && r->entry.name[0] != '\0'
+           && highscore_entry_get_checksum(r->entry) == r->checksum;
+}
+
+
+//
+// public
+//
+
+ShmRing *shmring_open_server(const char *name, int capacity) {
+    su32 cap = 1;
+    while (cap < (su32) capacity)
+        cap *= 2;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0660);
+    if (fd < 0) {
+        s_log_error("shmring failed to open: %s", name);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        s_log_error("shmring failed to stat: %s", name);
+        close(fd);
+        return NULL;
+    }
+
+    bool created = st.st_size == 0;
+    if (created && ftruncate(fd, segment_size(cap)) != 0) {
+        s_log_error("shmring failed to resize: %s", name);
+        close(fd);
+        return NULL;
+    }
+
+    ShmRing *self = ring_map(fd, created ? segment_size(cap) : st.st_size);
+    close(fd);
+    if (!self) {
+        s_log_error("shmring failed to map: %s", name);
+        return NULL;
+    }
+
+    if (created) {
+        ShmRingHeader_s *h = self->header;
+        h->capacity = cap;
+        h->record_size = sizeof(ShmRingRecord_s);
+        atomic_store(&h->head, 0);
+        atomic_store(&h->tail, 0);
+        for (su32 i = 0; i < cap; i++) {
+            atomic_store_explicit(&self->records[i].seq, i, memory_order_relaxed);
+        }
+        // producers only open the segment with the magic set
+        atomic_thread_fence(memory_order_release);
+        memcpy(h->magic, SHMRING_MAGIC, sizeof h->magic);
+    }
+
+    if (!ring_compatible(self)) {
+        s_log_error("shmring segment incompatible: %s (remove it with shm_unlink)", name);
+        shmring_kill(&self);
+        return NULL;
+    }
+
+    s_log("shmring %s: %s with %u records, %llu pending", created ? "created" : "opened", name,
+          self->header->capacity, (unsigned long long) shmring_pending(self));
+    return self;
+}
+
+ShmRing *shmring_open_producer(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    ShmRing *self = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(ShmRingHeader_s))
+        self = ring_map(fd, st.st_size);
+    close(fd);
+    if (self && !ring_compatible(self))
+        shmring_kill(&self);
+    return self;
+}
+
+void shmring_kill(ShmRing **self_ptr) {
+    ShmRing *self = *self_ptr;
+    if (!self)
+        return;
+    munmap(self->header, self->size);
+    s_free(self);
+    *self_ptr = NULL;
+}
+
+bool shmring_push_entry(ShmRing *self, const char *topic, HighscoreEntry_s entry) {
+    ShmRingRecord_s record = {.is_pack = false, .entry = entry};
+    if (strlen(topic) >= sizeof record.topic)
+        return false;
+    strcpy(record.topic, topic);
+    record.checksum = highscore_entry_get_checksum(entry);
+    return push(self, &record);
+}
+
+bool shmring_push_pack_entry(ShmRing *self, const char *topic, HighscorePackEntry_s entry) {
+    ShmRingRecord_s record = {.is_pack = true, .pack_entry = entry};
+    if (strlen(topic) >= sizeof record.topic)
+        return false;
+    strcpy(record.topic, topic);
+    record.checksum = highscorepack_entry_get_checksum(entry);
+    return push(self, &record);
+}
+
+int shmring_drain(ShmRing *self, int max, shmring_record_fn fn, void *user_data) {
+    ShmRingHeader_s *h = self->header;
+    su64 tail = atomic_load_explicit(&h->tail, memory_order_relaxed);
+    int n = 0;
+    for (; n < max; n++, tail++) {
+        ShmRingRecord_s *slot = &self->records[tail & self->mask];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != tail + 1)
+            break;
+
+        // copied, so a misbehaving producer can not change the record while it is checked
+        ShmRingRecord_s record = *slot;
+        if (!record_valid(&record)) {
+            atomic_fetch_add(&self->invalid, 1);
+        } else if (!fn(&record, user_data)) {
+            break;
+        }
+
+        // free for the producers of the next round
+        atomic_store_explicit(&slot->seq, tail + self->mask + 1, memory_order_release);
+    }
+    atomic_store_explicit(&h->tail, tail, memory_order_release);
+    return n;
+}
+
+su64 shmring_pending(const ShmRing *self) {
+    su64 head = atomic_load(&self->header->head);
+    su64 tail = atomic_load(&self->header->tail);
+    return head - tail;
+}
+
+su64 shmring_invalid(const ShmRing *self) {
+    return atomic_load(&((ShmRing *) self)->invalid);
+}
+
+void shmring_add_invalid(ShmRing *self) {
+    atomic_fetch_add(&self->invalid, 1);
+}
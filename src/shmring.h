@@ -0,0 +1,96 @@
+#ifndef HIGHSCORESERVER_SHMRING_H
+#define HIGHSCORESERVER_SHMRING_H
+
+//
+// Shared memory submission ring for local producers
+//      processes on the same machine write entries into a ring in a shared memory segment (shm_open),
+//      the server drains it in batches, without a socket, http or the text codec
+//      the ring is a bounded multi producer single consumer queue,
+//      each slot has a sequence number, so producers only need an atomic compare and swap on the head
+//      each record carries the checksum of its entry (as in the text codec, highscore_entry_get_checksum),
+//      records with a wrong checksum are dropped by the server
+//      the segment survives a restart of the server, so records written while it is down are kept
+//      a producer that dies between claiming and publishing a slot stalls the ring
+//
+// Layout (for producers in other languages, all integers in native byte order):
+//      ShmRingHeader_s, followed by capacity ShmRingRecord_s
+//      producer: pos = head; slot = records[pos % capacity];
+//                if slot.seq == pos and cas(head, pos, pos + 1): write the record, then slot.seq = pos + 1 (release)
+//                if slot.seq < pos: the ring is full
+//
+
+#include <stdatomic.h>
+#include "highscore.h"
+
+#define SHMRING_MAGIC "HSRING02"
+
+typedef struct {
+    // SHMRING_MAGIC, written last when the segment is created
+    char magic[8];
+    su32 capacity;      // power of 2
+    su32 record_size;   // sizeof(ShmRingRecord_s), to detect incompatible producers
+    _Alignas(64) _Atomic su64 head;     // next slot to claim (producers)
+    _Alignas(64) _Atomic su64 tail;     // next slot to read (server)
+} ShmRingHeader_s;
+
+typedef struct {
+    // == position: free for the producer of position
+    // == position + 1: published, ready for the server
+    _Atomic su64 seq;
+
+    // highscore_entry_get_checksum or highscorepack_entry_get_checksum of the entry
+    su64 checksum;
+
+    su8 is_pack;
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];     // 0 terminated, as in the udp api (pack topics start with pack/)
+
+    // is_pack ? pack_entry : entry
+    union {
+        HighscoreEntry_s entry;
+        HighscorePackEntry_s pack_entry;
+    };
+} ShmRingRecord_s;
+
+typedef struct ShmRing ShmRing;
+
+// called by shmring_drain for each valid record
+// returns false to stop draining, the record stays in the ring
+// a record that is dropped by fn should be counted with shmring_add_invalid
+typedef bool (*shmring_record_fn)(const ShmRingRecord_s *record, void *user_data);
+
+
+// opens or creates the segment name (like "/highscore_entries") with capacity records (rounded up to a power of 2)
+// an existing compatible segment is kept with its records
+// returns NULL on error (logged)
+ShmRing *shmring_open_server(const char *name, int capacity);
+
+// opens an existing segment as producer
+// returns NULL if it does not exist or is not compatible
+ShmRing *shmring_open_producer(const char *name);
+
+// unmaps the segment (the segment itself stays)
+void shmring_kill(ShmRing **self_ptr);
+
+// producer, writes the entry with its checksum into the ring
+// topic must be 0 terminated and shorter than HIGHSCORE_TOPIC_MAX_LENGTH
+// returns false if the ring is full
+bool shmring_push_entry(ShmRing *self, const char *topic, HighscoreEntry_s entry);
+
+// producer, same as shmring_push_entry for a pack topic
+bool shmring_push_pack_entry(ShmRing *self, const char *topic, HighscorePackEntry_s entry);
+
+// server, calls fn for up to max published records in order
+// records with a wrong checksum or without a terminated topic or entry are dropped and counted
+// returns the number of consumed records (valid and invalid)
+int shmring_drain(ShmRing *self, int max, shmring_record_fn fn, void *user_data);
+
+// returns the number of published or claimed records, that are not drained yet
+su64 shmring_pending(const ShmRing *self);
+
+// returns the number of dropped invalid records
+su64 shmring_invalid(const ShmRing *self);
+
+// counts a record as invalid, that was dropped by the shmring_record_fn (for example for an invalid topic)
+void shmring_add_invalid(ShmRing *self);
+
+#endif //HIGHSCORESERVER_SHMRING_H
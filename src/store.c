@@ -0,0 +1,419 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "s/s.h"
+#include "s/time.h"
+#include "highscore.h"
+#include "store.h"
+
+// topic -> offset+1 of its record
+#define TYPE ssize
+#define CLASS StoreIndex
+#define FN_NAME store_index
+
+#include "s/hashmap_string.h"
+
+typedef struct {
+    ssize offset;
+    ssize capacity;
+} StoreBlock_s;
+
+#define TYPE StoreBlock_s
+#define CLASS StoreBlocks
+#define FN_NAME store_blocks
+
+#include "s/dynarray.h"
+
+
+// records and blocks are aligned to this
+#define STORE_ALIGN 64
+
+// file header, in front of the first record
+#define STORE_HEADER_SIZE 64
+
+// the store file starts with this size and doubles if needed
+#define STORE_INITIAL_SIZE (1024 * 1024)
+
+// buckets of the index hashmap
+#define STORE_INDEX_SIZE 65536
+
+// a free block is split, if at least this many bytes are left
+#define STORE_SPLIT_MIN 256
+
+// free blocks are only merged up to this capacity (StoreRecord_s.capacity is a su32)
+#define STORE_BLOCK_MAX ((ssize) (UINT32_MAX / STORE_ALIGN * STORE_ALIGN))
+
+// "HSSTORE2"
+#define STORE_FILE_MAGIC 0x3245524f54535348ULL
+#define STORE_USED_MAGIC 0x44455355   // "USED"
+#define STORE_FREE_MAGIC 0x45455246   // "FREE"
+
+// followed by size bytes of data
+typedef struct {
+    su32 magic;
+    su32 capacity;      // bytes of the block, including this header
+    su64 generation;    // newest record of a topic wins
+    su32 size;
+    su32 crc;           // crc32 of the generation, the topic and the data
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+} StoreRecord_s;
+
+
+static struct {
+    bool enabled;
+    pthread_mutex_t lock;
+
+    int fd;
+    char *map;
+    ssize map_size;
+
+    // first byte, that was never used
+    ssize end;
+
+    su64 generation;
+    StoreIndex index;
+
+    // sorted by offset, neighbours are merged
+    StoreBlocks free;
+
+    // old records of written topics, released with the next store_commit
+    StoreBlocks released;
+} L = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+
+static StoreRecord_s *record_at(ssize offset) {
+    return (StoreRecord_s *) (L.map + offset);
+}
+
+static su32 record_crc(const StoreRecord_s *r) {
+    // the generation decides which record of a topic wins, so a torn generation must be detected too
+    uLong crc = crc32(0, (const Bytef *) &r->generation, sizeof r->generation);
+    crc = crc32(crc, (const Bytef *) r->topic, sizeof r->topic);
+    return (su32) crc32(crc, (const Bytef *) (r + 1), r->size);
+}
+
+static bool block_sane(ssize offset, ssize capacity) {
+    return capacity >= (ssize) sizeof(StoreRecord_s)
+           && capacity % STORE_ALIGN == 0
+           && offset + capacity <= L.map_size;
+}
+
+static bool record_valid(ssize offset) {
+    if (offset + (ssize) sizeof(StoreRecord_s) > L.map_size)
+        return false;
+    const StoreRecord_s *r = record_at(offset);
+    return r->magic == STORE_USED_MAGIC
+           && block_sane(offset, r->capacity)
+           && (ssize) sizeof(StoreRecord_s) + r->size <= r->capacity
+           && r->topic[HIGHSCORE_TOPIC_MAX_LENGTH - 1] == '\0'
+           && r->crc == record_crc(r);
+}
+
+static void block_mark_free(ssize offset, ssize capacity) {
+    StoreRecord_s *r = record_at(offset);
+    memset(r, 0, sizeof *r);
+    r->magic = STORE_FREE_MAGIC;
+    r->capacity = (su32) capacity;
+}
+
+// returns the index of the first free block at or after offset
+static ssize free_lower_bound(ssize offset) {
+    ssize lo = 0, hi = L.free.size;
+    while (lo < hi) {
+        ssize mid = lo + (hi - lo) / 2;
+        if (L.free.array[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void free_remove(ssize i) {
+    memmove(&L.free.array[i], &L.free.array[i + 1], (L.free.size - i - 1) * sizeof *L.free.array);
+    L.free.size--;
+}
+
+static void free_insert(ssize i, StoreBlock_s block) {
+    store_blocks_push(&L.free, block);
+    memmove(&L.free.array[i + 1], &L.free.array[i], (L.free.size - i - 1) * sizeof *L.free.array);
+    L.free.array[i] = block;
+}
+
+// frees the block and merges it with its free neighbours
+// a block that ends at L.end is given back to the unused space
+static void block_free(ssize offset, ssize capacity) {
+    ssize i = free_lower_bound(offset);
+    if (i < L.free.size) {
+        StoreBlock_s next = L.free.array[i];
+        if (offset + capacity == next.offset && capacity + next.capacity <= STORE_BLOCK_MAX) {
+            capacity += next.capacity;
+            free_remove(i);
+        }
+    }
+    if (i > 0) {
+        StoreBlock_s prev = L.free.array[i - 1];
+        if (prev.offset + prev.capacity == offset && prev.capacity + capacity <= STORE_BLOCK_MAX) {
+            offset = prev.offset;
+            capacity += prev.capacity;
+            free_remove(--i);
+        }
+    }
+    block_mark_free(offset, capacity);
+    if (offset + capacity == L.end) {
+        L.end = offset;
+        return;
+    }
+    free_insert(i, (StoreBlock_s) {offset, capacity});
+}
+
+static bool grow(ssize min_size) {
+    ssize size = L.map_size;
+    while (size < min_size)
+        size *= 2;
+    if (ftruncate(L.fd, size) != 0) {
+        s_log_error("store failed to grow the file to %zu bytes", size);
+        return false;
+    }
+    void *map = mremap(L.map, L.map_size, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        s_log_error("store failed to remap the file");
+        return false;
+    }
+    L.map = map;
+    L.map_size = size;
+    return true;
+}
+
+// first fit (lowest offset) of the free blocks, or a new block at the end
+// returns the offset of the block or -1
+static ssize block_alloc(ssize capacity, ssize *out_capacity) {
+    for (ssize i = 0; i < L.free.size; i++) {
+        StoreBlock_s block = L.free.array[i];
+        if (block.capacity < capacity)
+            continue;
+        if (block.capacity - capacity >= STORE_SPLIT_MIN) {
+            // the rest stays at the same position of the sorted list, its neighbours are not free
+            StoreBlock_s rest = {block.offset + capacity, block.capacity - capacity};
+            block_mark_free(rest.offset, rest.capacity);
+            L.free.array[i] = rest;
+            block.capacity = capacity;
+        } else {
+            free_remove(i);
+        }
+        *out_capacity = block.capacity;
+        return block.offset;
+    }
+
+    if (L.end + capacity > L.map_size && !grow(L.end + capacity))
+        return -1;
+    ssize offset = L.end;
+    L.end += capacity;
+    *out_capacity = capacity;
+    return offset;
+}
+
+// adds a valid record to the index, the older record of a topic is freed
+static void index_record(ssize offset) {
+    StoreRecord_s *r = record_at(offset);
+    L.generation = s_max(L.generation, r->generation);
+    ssize *index = store_index_get(&L.index, r->topic);
+    if (*index > 0) {
+        StoreRecord_s *other = record_at(*index - 1);
+        if (other->generation > r->generation) {
+            block_free(offset, r->capacity);
+            return;
+        }
+        block_free(*index - 1, other->capacity);
+    }
+    *index = offset + 1;
+}
+
+// builds the index and the free blocks
+// space between valid records (free blocks, invalid records of a crash) is merged into free blocks
+static void scan() {
+    ssize offset = STORE_HEADER_SIZE;
+    ssize run = -1;  // start of the current free space
+    while (offset + (ssize) sizeof(StoreRecord_s) <= L.map_size) {
+        StoreRecord_s *r = record_at(offset);
+        if (record_valid(offset)) {
+            if (run >= 0) {
+                block_free(run, offset - run);
+                run = -1;
+            }
+            ssize capacity = r->capacity;
+            index_record(offset);
+            offset += capacity;
+            continue;
+        }
+
+        if (run < 0)
+            run = offset;
+        // skip a free block, else search the next valid record
+        if (r->magic == STORE_FREE_MAGIC && block_sane(offset, r->capacity))
+            offset += r->capacity;
+        else
+            offset += STORE_ALIGN;
+    }
+    // trailing free space is unused
+    L.end = run >= 0 ? run : offset;
+    if (L.free.size > 0) {
+        StoreBlock_s last = L.free.array[L.free.size - 1];
+        if (last.offset + last.capacity == L.end) {
+            L.end = last.offset;
+            L.free.size--;
+        }
+    }
+}
+
+
+//
+// public
+//
+
+bool store_open(const char *file) {
+    sTimer_s timer = s_timer_new();
+    int fd = open(file, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        s_log_error("store failed to open: %s", file);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        s_log_error("store failed to stat: %s", file);
+        close(fd);
+        return false;
+    }
+
+    ssize size = st.st_size;
+    bool created = size < STORE_HEADER_SIZE;
+    if (created) {
+        size = STORE_INITIAL_SIZE;
+        if (ftruncate(fd, size) != 0) {
+            s_log_error("store failed to create: %s", file);
+            close(fd);
+            return false;
+        }
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        s_log_error("store failed to map: %s", file);
+        close(fd);
+        return false;
+    }
+
+    su64 magic = STORE_FILE_MAGIC;
+    if (created) {
+        memcpy(map, &magic, sizeof magic);
+    } else if (memcmp(map, &magic, sizeof magic) != 0) {
+        s_log_error("store file invalid: %s", file);
+        munmap(map, size);
+        close(fd);
+        return false;
+    }
+
+    L.fd = fd;
+    L.map = map;
+    L.map_size = size;
+    L.index = store_index_new(STORE_INDEX_SIZE);
+    L.free = store_blocks_new(64);
+    L.released = store_blocks_new(64);
+    scan();
+    L.enabled = true;
+
+    int topics = 0;
+    StoreIndexIter_s iter = store_index_iter_new(&L.index);
+    while (store_index_iter_next(&iter))
+        topics++;
+    s_log("store opened: %s with %i topics, %i free blocks, %.1f MiB in %.3f s",
+          file, topics, (int) L.free.size, L.map_size / (1024.0 * 1024.0), s_timer_elapsed(timer));
+    return true;
+}
+
+bool store_enabled() {
+    return L.enabled;
+}
+
+sString *store_read(const char *topic) {
+    sString *data = s_string_new_invalid();
+    pthread_mutex_lock(&L.lock);
+    {
+        ssize *index = store_index_get(&L.index, topic);
+        if (*index > 0) {
+            const StoreRecord_s *r = record_at(*index - 1);
+            data = s_string_new_clone((sStr_s) {(char *) (r + 1), r->size});
+        } else {
+            // do not keep unavailable topics in the index
+            store_index_remove(&L.index, topic);
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+    return data;
+}
+
+bool store_write(const char *topic, sStr_s data) {
+    ssize capacity = sizeof(StoreRecord_s) + data.size;
+    capacity = (capacity + STORE_ALIGN - 1) / STORE_ALIGN * STORE_ALIGN;
+
+    bool ok = false;
+    pthread_mutex_lock(&L.lock);
+    {
+        ssize offset = block_alloc(capacity, &capacity);
+        if (offset >= 0) {
+            StoreRecord_s *r = record_at(offset);
+            memset(r, 0, sizeof *r);
+            snprintf(r->topic, sizeof r->topic, "%s", topic);
+            memcpy(r + 1, data.data, data.size);
+            r->capacity = (su32) capacity;
+            r->generation = ++L.generation;
+            r->size = (su32) data.size;
+            r->crc = record_crc(r);
+            r->magic = STORE_USED_MAGIC;
+
+            ssize *index = store_index_get(&L.index, topic);
+            if (*index > 0) {
+                // keep the old record until the new one is synced
+                store_blocks_push(&L.released, (StoreBlock_s) {*index - 1, record_at(*index - 1)->capacity});
+            }
+            *index = offset + 1;
+            ok = true;
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    if (!ok)
+        s_log_error("store failed to write the topic: %s", topic);
+    return ok;
+}
+
+void store_commit(bool sync) {
+    // only the writing thread grows (remaps) the file, so the map is stable here
+    if (sync && (msync(L.map, L.map_size, MS_SYNC) != 0 || fsync(L.fd) != 0)) {
+        s_log_error("store failed to sync");
+    }
+
+    pthread_mutex_lock(&L.lock);
+    {
+        for (ssize i = 0; i < L.released.size; i++) {
+            block_free(L.released.array[i].offset, L.released.array[i].capacity);
+        }
+        L.released.size = 0;
+    }
+    pthread_mutex_unlock(&L.lock);
+}
+
+void store_for_each_topic(void (*fn)(const char *topic, void *user_data), void *user_data) {
+    pthread_mutex_lock(&L.lock);
+    {
+        StoreIndexIter_s iter = store_index_iter_new(&L.index);
+        StoreIndexItem_s *item;
+        while ((item = store_index_iter_next(&iter))) {
+            fn(item->key, user_data);
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+}
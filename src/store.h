@@ -0,0 +1,41 @@
+#ifndef HIGHSCORESERVER_STORE_H
+#define HIGHSCORESERVER_STORE_H
+
+//
+// Single file topic store
+//      alternative to a topic file per topic, all topics are stored in a single mmapped data file
+//      each topic is a record (64 byte aligned) with a generation and a crc (of the generation, topic and data),
+//      an in memory index maps the topics to their records
+//      a write always creates a new record in a free block (first fit) or at the end of the file,
+//      the old record is released (free) with the next store_commit and merged with its free neighbours,
+//      so after a crash the old or the new version of a topic is available
+//      (on open, the newest valid record of a topic wins, invalid records are free)
+//
+
+#include "s/s.h"
+#include "s/str.h"
+#include "s/string.h"
+
+// opens or creates the store file and builds the index
+// all other functions may only be called, if the store was opened
+bool store_open(const char *file);
+
+// returns true if the store was opened
+bool store_enabled();
+
+// returns a copy of the encoded topic, or an invalid string if the topic is not in the store
+// topic must be 0 terminated!
+sString *store_read(const char *topic);
+
+// writes the encoded topic into a new record (single writer only)
+// the old record is released with the next store_commit
+// topic must be 0 terminated!
+bool store_write(const char *topic, sStr_s data);
+
+// syncs the store file, if sync is true, and releases the old records of the written topics
+void store_commit(bool sync);
+
+// calls fn for each topic in the store
+void store_for_each_topic(void (*fn)(const char *topic, void *user_data), void *user_data);
+
+#endif //HIGHSCORESERVER_STORE_H
@@ -0,0 +1,622 @@
+#include <pthread.h>
+#include <ftw.h>
+#include <zlib.h>
+#include "s/s.h"
+#include "s/file.h"
+#include "s/str.h"
+#include "s/string.h"
+#include "s/time.h"
+#include "topics.h"
+#include "store.h"
+#include "persist.h"
+#include "cold.h"
+#include "metrics.h"
+
+// a topic in the map, with its position in the lru list
+typedef struct TopicSlot {
+    TopicData *data;
+    struct TopicSlot *prev;   // more recently used
+    struct TopicSlot *next;   // less recently used
+    double used;              // s_time_monotonic of the last get or set
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+} TopicSlot;
+
+#define TYPE TopicSlot *
+#define CLASS TopicMap
+#define FN_NAME topic_map
+
+#include "s/hashmap_string.h"
+
+typedef struct {
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+} TopicName_s;
+
+#define TYPE TopicName_s
+#define CLASS TopicNames
+#define FN_NAME topic_names
+
+#include "s/dynarray.h"
+
+
+// buckets of the topic hashmap
+#define TOPICS_MAP_SIZE 65536
+
+// max topics, that are not evictable, probed in an eviction
+#define TOPICS_EVICT_PROBES 32
+
+
+// protected functions:
+
+Highscore highscore_decode(sStr_s msg);
+
+sString *highscore_encode(Highscore self);
+
+HighscorePack highscorepack_decode(sStr_s msg);
+
+sString *highscorepack_encode(HighscorePack self);
+
+
+static struct {
+    pthread_mutex_t lock;
+    TopicMap map;
+
+    // lru list of the slots, protected by lock
+    TopicSlot *lru_head;
+    TopicSlot *lru_tail;
+    ssize topics;
+    ssize bytes;
+
+    // memory budget, <=0 for unlimited
+    ssize budget;
+    topics_evictable_fn evictable;
+
+    // if false, topics_get does not load topic files
+    atomic_bool loading;
+
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t misses;
+    atomic_uint_fast64_t evictions;
+} L = {PTHREAD_MUTEX_INITIALIZER, .loading = true};
+
+// state of topics_preload
+static struct {
+    TopicNames names;
+    atomic_int next;
+    atomic_int loaded;
+    sTimer_s timer;
+} preload;
+
+
+// compresses the encoded topic into the gzip and deflate (zlib) variants
+// the raw deflate stream is only computed once and wrapped with both headers
+static void topicdata_compress(TopicData *self, sStr_s encoded) {
+    if (encoded.size < TOPICS_COMPRESS_MIN_SIZE)
+        return;
+
+    z_stream z = {0};
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        s_log_error("topicdata_compress failed to init zlib");
+        return;
+    }
+    uLong bound = deflateBound(&z, (uLong) encoded.size);
+
+    // 10 bytes gzip header in front and 8 bytes trailer (crc32 + size)
+    sString *gzip = s_string_new((ssize) bound + 18);
+    z.next_in = (Bytef *) encoded.data;
+    z.avail_in = (uInt) encoded.size;
+    z.next_out = (Bytef *) gzip->data + 10;
+    z.avail_out = (uInt) bound;
+    int res = deflate(&z, Z_FINISH);
+    ssize raw_size = (ssize) z.total_out;
+    deflateEnd(&z);
+    if (res != Z_STREAM_END) {
+        s_log_error("topicdata_compress failed to deflate");
+        s_string_kill(&gzip);
+        return;
+    }
+
+    uLong crc = crc32(crc32(0, Z_NULL, 0), (const Bytef *) encoded.data, (uInt) encoded.size);
+    uLong adler = adler32(adler32(0, Z_NULL, 0), (const Bytef *) encoded.data, (uInt) encoded.size);
+    su8 *raw = (su8 *) gzip->data + 10;
+
+    // deflate = zlib header + raw + adler32 (big endian)
+    sString *zlib = s_string_new(raw_size + 6);
+    su8 *d = (su8 *) zlib->data;
+    d[0] = 0x78;
+    d[1] = 0x9c;    // default compression, (0x789c % 31 == 0)
+    memcpy(d + 2, raw, raw_size);
+    for (int i = 0; i < 4; i++)
+        d[2 + raw_size + i] = (su8) (adler >> (24 - 8 * i));
+    zlib->size = raw_size + 6;
+
+    // gzip = header + raw + crc32 + size (little endian)
+    su8 *g = (su8 *) gzip->data;
+    const su8 header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};   // deflate, unix
+    memcpy(g, header, 10);
+    for (int i = 0; i < 4; i++) {
+        g[10 + raw_size + i] = (su8) (crc >> (8 * i));
+        g[14 + raw_size + i] = (su8) ((su64) encoded.size >> (8 * i));
+    }
+    gzip->size = raw_size + 18;
+
+    self->gzip = gzip;
+    self->deflate = zlib;
+}
+
+// approximated memory usage of the topic data
+static ssize topicdata_bytes(const TopicData *self) {
+    ssize bytes = sizeof *self;
+    bytes += self->highscore.entries_size * (ssize) sizeof(HighscoreEntry_s);
+    bytes += self->pack.entries_size * (ssize) sizeof(HighscorePackEntry_s);
+    if (s_string_valid(self->gzip))
+        bytes += self->gzip->capacity;
+    if (s_string_valid(self->deflate))
+        bytes += self->deflate->capacity;
+    return bytes;
+}
+
+// loads the topic from its topic file (or the store or the cold archive)
+// if it was loaded from the cold archive, out_restored is set to its encoded data, else invalid
+// returns NULL if the topic file is not available
+static TopicData *topics_load(const char *topic, sString **out_restored) {
+    char file[256];
+    snprintf(file, 256, "topics/%s.txt", topic);
+    *out_restored = s_string_new_invalid();
+
+    // topics that are not in the store (yet) are loaded from their topic file
+    sTimer_s timer = s_timer_new();
+    sString *msg = store_enabled() ? store_read(topic) : s_string_new_invalid();
+    if (!s_string_valid(msg))
+        msg = s_file_read(file, true);
+    if (!s_string_valid(msg) && cold_enabled()) {
+        msg = cold_read(topic);
+        if (s_string_valid(msg))
+            *out_restored = s_string_new_clone(s_string_get_str(msg));
+    }
+    metrics_stage(METRICS_STAGE_FILE_READ, timer);
+    if (!s_string_valid(msg))
+        return NULL;
+    metrics_add(METRICS_FILE_READ_BYTES, msg->size);
+
+    TopicData *data;
+    if (topics_is_pack(topic)) {
+        timer = s_timer_new();
+        HighscorePack pack = highscorepack_decode(s_string_get_str(msg));
+        metrics_stage(METRICS_STAGE_DECODE, timer);
+        timer = s_timer_new();
+        sString *encoded = highscorepack_encode(pack);
+        data = topicdata_new_pack(pack, s_string_get_str(encoded));
+        metrics_stage(METRICS_STAGE_ENCODE, timer);
+        s_string_kill(&encoded);
+    } else {
+        timer = s_timer_new();
+        Highscore highscore = highscore_decode(s_string_get_str(msg));
+        metrics_stage(METRICS_STAGE_DECODE, timer);
+        timer = s_timer_new();
+        sString *encoded = highscore_encode(highscore);
+        data = topicdata_new_highscore(highscore, s_string_get_str(encoded));
+        metrics_stage(METRICS_STAGE_ENCODE, timer);
+        s_string_kill(&encoded);
+    }
+    s_string_kill(&msg);
+    return data;
+}
+
+static void lru_unlink(TopicSlot *slot) {
+    if (slot->prev)
+        slot->prev->next = slot->next;
+    else
+        L.lru_head = slot->next;
+    if (slot->next)
+        slot->next->prev = slot->prev;
+    else
+        L.lru_tail = slot->prev;
+    slot->prev = slot->next = NULL;
+}
+
+static void lru_push_front(TopicSlot *slot) {
+    slot->prev = NULL;
+    slot->next = L.lru_head;
+    if (L.lru_head)
+        L.lru_head->prev = slot;
+    L.lru_head = slot;
+    if (!L.lru_tail)
+        L.lru_tail = slot;
+}
+
+// evicts the least recently used topics, until the memory budget is met (lock must be held)
+// the most recently used topic is never evicted
+// topics, that are not evictable, get a second chance (moved to the front), so at most
+// TOPICS_EVICT_PROBES topics are not evictable in a call
+// returns the evicted slots, chained by next, to be killed with evicted_kill outside of the lock
+static TopicSlot *evict() {
+    TopicSlot *evicted = NULL;
+    if (L.budget <= 0)
+        return NULL;
+
+    int probes = 0;
+    while (L.bytes > L.budget && L.lru_tail && L.lru_tail != L.lru_head) {
+        TopicSlot *slot = L.lru_tail;
+        lru_unlink(slot);
+
+        // dirty topics would lose their updates, if reloaded from their (old) topic file
+        if (L.evictable && !L.evictable(slot->topic)) {
+            lru_push_front(slot);
+            if (++probes >= TOPICS_EVICT_PROBES)
+                break;
+            continue;
+        }
+
+        topic_map_remove(&L.map, slot->topic);
+        L.topics--;
+        L.bytes -= slot->data->bytes;
+        atomic_fetch_add(&L.evictions, 1);
+        slot->next = evicted;
+        evicted = slot;
+    }
+    return evicted;
+}
+
+static void evicted_kill(TopicSlot *evicted) {
+    while (evicted) {
+        TopicSlot *next = evicted->next;
+        topicdata_unref(&evicted->data);
+        s_free(evicted);
+        evicted = next;
+    }
+}
+
+// sets the data of a topic slot and marks it as most recently used (lock must be held)
+// takes the reference of data
+// if replace is false and the topic is already in the map, data is not set
+// returns the old (or not set) data, to be unreffed outside of the lock
+static TopicData *slot_set(const char *topic, TopicData *data, bool replace) {
+    TopicSlot **item = topic_map_get(&L.map, topic);
+    TopicSlot *slot = *item;
+    if (slot && !replace)
+        return data;
+
+    TopicData *old = NULL;
+    if (slot) {
+        old = slot->data;
+        L.bytes -= old->bytes;
+        lru_unlink(slot);
+    } else {
+        slot = s_new0(TopicSlot, 1);
+        snprintf(slot->topic, sizeof slot->topic, "%s", topic);
+        *item = slot;
+        L.topics++;
+    }
+    slot->data = data;
+    slot->used = s_time_monotonic();
+    L.bytes += data->bytes;
+    lru_push_front(slot);
+    return old;
+}
+
+// nftw callback, collects all topic files
+static int preload_collect(const char *path, const struct stat *sb, int type, struct FTW *ftw) {
+    if (type != FTW_F)
+        return 0;
+
+    // path is "topics/<topic>.txt", skip temp files and others
+    sStr_s file = s_strc(path);
+    if (!s_str_begins_with(file, s_strc("topics/")) || !s_str_ends_with(file, s_strc(".txt")))
+        return 0;
+    sStr_s topic = {file.data + 7, file.size - 7 - 4};
+    if (topic.size <= 0 || topic.size >= HIGHSCORE_TOPIC_MAX_LENGTH)
+        return 0;
+
+    TopicName_s name;
+    s_str_as_c(name.topic, topic);
+    topic_names_push(&preload.names, name);
+    return 0;
+}
+
+// store_for_each_topic callback, collects all topics of the store
+static void preload_collect_store(const char *topic, void *user_data) {
+    TopicName_s name;
+    snprintf(name.topic, sizeof name.topic, "%s", topic);
+    topic_names_push(&preload.names, name);
+}
+
+// loads the collected topics, until all are taken by the preload threads
+static void *preload_thread(void *arg) {
+    for (;;) {
+        int i = atomic_fetch_add(&preload.next, 1);
+        if (i >= preload.names.size)
+            break;
+        const char *topic = preload.names.array[i].topic;
+
+        sString *restored;
+        TopicData *data = topics_load(topic, &restored);
+        s_string_kill(&restored);
+        if (!data)
+            continue;
+
+        TopicSlot *evicted;
+        metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+        {
+            // do not replace a topic, that was already set
+            data = slot_set(topic, data, false);
+            evicted = evict();
+        }
+        pthread_mutex_unlock(&L.lock);
+        topicdata_unref(&data);
+        evicted_kill(evicted);
+
+        int loaded = atomic_fetch_add(&preload.loaded, 1) + 1;
+        if (loaded % TOPICS_PRELOAD_PROGRESS == 0) {
+            s_log("topics_preload: %i / %i topics loaded (%.1f s)",
+                  loaded, (int) preload.names.size, s_timer_elapsed(preload.timer));
+        }
+    }
+    return NULL;
+}
+
+//
+// public
+//
+
+TopicData *topicdata_new_highscore(Highscore highscore, sStr_s encoded) {
+    TopicData *self = s_new0(TopicData, 1);
+    atomic_init(&self->refs, 1);
+    self->is_pack = false;
+    self->highscore = highscore;
+    self->encoded_size = encoded.size;
+    topicdata_compress(self, encoded);
+    self->bytes = topicdata_bytes(self);
+    return self;
+}
+
+TopicData *topicdata_new_pack(HighscorePack pack, sStr_s encoded) {
+    TopicData *self = s_new0(TopicData, 1);
+    atomic_init(&self->refs, 1);
+    self->is_pack = true;
+    self->pack = pack;
+    self->encoded_size = encoded.size;
+    topicdata_compress(self, encoded);
+    self->bytes = topicdata_bytes(self);
+    return self;
+}
+
+TopicData *topicdata_ref(TopicData *self) {
+    atomic_fetch_add(&self->refs, 1);
+    return self;
+}
+
+void topicdata_unref(TopicData **self_ptr) {
+    TopicData *self = *self_ptr;
+    *self_ptr = NULL;
+    if (!self || atomic_fetch_sub(&self->refs, 1) > 1)
+        return;
+    highscore_kill(&self->highscore);
+    highscorepack_kill(&self->pack);
+    s_string_kill(&self->gzip);
+    s_string_kill(&self->deflate);
+    s_free(self);
+}
+
+bool topics_is_pack(const char *topic) {
+    return strncmp(topic, "pack/", 5) == 0;
+}
+
+TopicData *topics_get(const char *topic) {
+    TopicData *data = NULL;
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        if (!topic_map_valid(L.map))
+            L.map = topic_map_new(TOPICS_MAP_SIZE);
+
+        TopicSlot **item = topic_map_get(&L.map, topic);
+        if (*item) {
+            data = topicdata_ref((*item)->data);
+            (*item)->used = s_time_monotonic();
+            lru_unlink(*item);
+            lru_push_front(*item);
+        } else {
+            // do not keep unavailable topics in the map
+            topic_map_remove(&L.map, topic);
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    if (data) {
+        atomic_fetch_add(&L.hits, 1);
+        return data;
+    }
+    atomic_fetch_add(&L.misses, 1);
+
+    if (!atomic_load(&L.loading))
+        return NULL;
+
+    // load outside of the lock, so other topics are not blocked by the file read
+    sString *restored;
+    data = topics_load(topic, &restored);
+    if (!data)
+        return NULL;
+
+    TopicData *unref;
+    TopicSlot *evicted;
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        // keeps the topic, if it was loaded or set by another thread in the meantime
+        unref = slot_set(topic, topicdata_ref(data), false);
+        if (unref) {
+            topicdata_unref(&data);
+            data = topicdata_ref((*topic_map_get(&L.map, topic))->data);
+        } else if (s_string_valid(restored)) {
+            // a cold topic gets its topic file back
+            // (within the lock, so a later update of the topic is persisted after it)
+            persist_add(topic, restored);
+            restored = NULL;
+        }
+        evicted = evict();
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    s_string_kill(&restored);
+    topicdata_unref(&unref);
+    evicted_kill(evicted);
+    return data;
+}
+
+void topics_set(const char *topic, TopicData *data) {
+    TopicData *old;
+    TopicSlot *evicted;
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        if (!topic_map_valid(L.map))
+            L.map = topic_map_new(TOPICS_MAP_SIZE);
+
+        old = slot_set(topic, data, true);
+        evicted = evict();
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    topicdata_unref(&old);
+    evicted_kill(evicted);
+}
+
+bool topics_run_if_absent(const char *topic, topics_absent_fn fn, void *user_data) {
+    bool ran = false;
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        if (!topic_map_valid(L.map))
+            L.map = topic_map_new(TOPICS_MAP_SIZE);
+
+        TopicSlot **item = topic_map_get(&L.map, topic);
+        if (!*item) {
+            topic_map_remove(&L.map, topic);
+            ran = fn ? fn(topic, user_data) : true;
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+    return ran;
+}
+
+int topics_evict_idle(double idle_s, topics_evictable_fn evictable) {
+    TopicSlot *evicted = NULL;
+    int n = 0;
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        double idle_before = s_time_monotonic() - idle_s;
+        TopicSlot *slot = L.lru_tail;
+        // the list is ordered by use (apart from second chances), so stop at the first used slot
+        while (slot && slot->used < idle_before) {
+            TopicSlot *prev = slot->prev;
+            if (!evictable || evictable(slot->topic)) {
+                lru_unlink(slot);
+                topic_map_remove(&L.map, slot->topic);
+                L.topics--;
+                L.bytes -= slot->data->bytes;
+                slot->next = evicted;
+                evicted = slot;
+                n++;
+            }
+            slot = prev;
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    atomic_fetch_add(&L.evictions, n);
+    evicted_kill(evicted);
+    return n;
+}
+
+void topics_set_budget(ssize budget_bytes, topics_evictable_fn evictable) {
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        L.budget = budget_bytes;
+        L.evictable = evictable;
+    }
+    pthread_mutex_unlock(&L.lock);
+}
+
+TopicsStats_s topics_stats() {
+    TopicsStats_s stats;
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        stats.topics = L.topics;
+        stats.bytes = L.bytes;
+        stats.budget = L.budget;
+    }
+    pthread_mutex_unlock(&L.lock);
+    stats.hits = atomic_load(&L.hits);
+    stats.misses = atomic_load(&L.misses);
+    stats.evictions = atomic_load(&L.evictions);
+    return stats;
+}
+
+void topics_set_loading(bool load_files) {
+    atomic_store(&L.loading, load_files);
+}
+
+TopicRef_s *topics_collect(ssize *out_size) {
+    TopicRef_s *refs = NULL;
+    ssize size = 0;
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        if (!topic_map_valid(L.map))
+            L.map = topic_map_new(TOPICS_MAP_SIZE);
+
+        ssize capacity = 1024;
+        refs = s_new(TopicRef_s, capacity);
+        for (TopicSlot *slot = L.lru_head; slot; slot = slot->next) {
+            if (size >= capacity) {
+                capacity *= 2;
+                refs = s_renew(TopicRef_s, refs, capacity);
+            }
+            snprintf(refs[size].topic, sizeof refs[size].topic, "%s", slot->topic);
+            refs[size].data = topicdata_ref(slot->data);
+            size++;
+        }
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    *out_size = size;
+    return refs;
+}
+
+void topics_preload(int threads) {
+    preload.timer = s_timer_new();
+    preload.names = topic_names_new(1024);
+    atomic_init(&preload.next, 0);
+    atomic_init(&preload.loaded, 0);
+
+    metrics_lock(&L.lock, METRICS_LOCK_TOPICS);
+    {
+        if (!topic_map_valid(L.map))
+            L.map = topic_map_new(TOPICS_MAP_SIZE);
+    }
+    pthread_mutex_unlock(&L.lock);
+
+    // topics in the store and the topic files (topics_load prefers the store for a topic in both)
+    if (store_enabled())
+        store_for_each_topic(preload_collect_store, NULL);
+    if (nftw("topics", preload_collect, 32, FTW_PHYS) != 0) {
+        s_log_warn("topics_preload failed to walk the topics directory");
+    }
+    s_log("topics_preload: found %i topic files (%.3f s)",
+          (int) preload.names.size, s_timer_elapsed(preload.timer));
+
+    threads = s_clamp(threads, 1, TOPICS_PRELOAD_MAX_THREADS);
+    pthread_t ids[TOPICS_PRELOAD_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&ids[started], NULL, preload_thread, NULL) != 0) {
+            s_log_warn("topics_preload failed to create a thread");
+            break;
+        }
+        started++;
+    }
+    // the calling thread helps (and loads everything, if no thread could be created)
+    preload_thread(NULL);
+    for (int i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+
+    s_log("topics_preload: loaded %i topics with %i threads in %.3f s",
+          atomic_load(&preload.loaded), started + 1, s_timer_elapsed(preload.timer));
+    topic_names_kill(&preload.names);
+}
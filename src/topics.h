@@ -0,0 +1,123 @@
+#ifndef HIGHSCORESERVER_TOPICS_H
+#define HIGHSCORESERVER_TOPICS_H
+
+//
+// In memory cache of the topics
+//      a topic is loaded from its topic file (or the cold archive) on first use and stays in memory
+//      the data of a topic is immutable and reference counted,
+//      so a writer creates a new TopicData and replaces the old one (copy on write)
+//      and readers may use (stream) their reference without holding a lock
+//      with a memory budget, the least recently used topics are evicted (LRU)
+//
+
+#include <stdatomic.h>
+#include "highscore.h"
+
+// encoded topics smaller than this are not compressed
+#define TOPICS_COMPRESS_MIN_SIZE 256
+
+// max threads of topics_preload
+#define TOPICS_PRELOAD_MAX_THREADS 64
+
+// topics_preload logs its progress each n loaded topics
+#define TOPICS_PRELOAD_PROGRESS 10000
+
+typedef struct {
+    atomic_int refs;
+    bool is_pack;
+
+    // is_pack ? pack : highscore
+    Highscore highscore;
+    HighscorePack pack;
+
+    // size of the encoded topic (as in the topic file)
+    ssize encoded_size;
+
+    // compressed variants of the encoded topic, computed once for each TopicData
+    // invalid (NULL) if the encoded topic is smaller than TOPICS_COMPRESS_MIN_SIZE
+    sString *gzip;
+    sString *deflate;
+
+    // approximated memory usage, used for the memory budget
+    ssize bytes;
+} TopicData;
+
+// returns true if the topic may be evicted (its topic file or store record is up to date)
+typedef bool (*topics_evictable_fn)(const char *topic);
+
+// see topics_run_if_absent
+typedef bool (*topics_absent_fn)(const char *topic, void *user_data);
+
+typedef struct {
+    ssize topics;
+    ssize bytes;
+    ssize budget;
+    su64 hits;
+    su64 misses;
+    su64 evictions;
+} TopicsStats_s;
+
+// a topic with a reference of its data, see topics_collect
+typedef struct {
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+    TopicData *data;
+} TopicRef_s;
+
+
+// creates a new TopicData with a single reference and moves the highscore into it
+// encoded is the encoded highscore, used for the compressed variants
+TopicData *topicdata_new_highscore(Highscore highscore, sStr_s encoded);
+
+// creates a new TopicData with a single reference and moves the pack into it
+// encoded is the encoded pack, used for the compressed variants
+TopicData *topicdata_new_pack(HighscorePack pack, sStr_s encoded);
+
+// adds a reference and returns self
+TopicData *topicdata_ref(TopicData *self);
+
+// removes a reference and kills the data, if it was the last one
+// sets *self_ptr to NULL
+void topicdata_unref(TopicData **self_ptr);
+
+
+// returns true if the topic is a pack topic (starts with pack/)
+bool topics_is_pack(const char *topic);
+
+// returns the data of the topic with a new reference (unref it!)
+// loads the topic file, if the topic is not in memory yet
+// returns NULL if the topic is not available
+TopicData *topics_get(const char *topic);
+
+// replaces the data of the topic and takes the reference of data
+void topics_set(const char *topic, TopicData *data);
+
+// calls fn with the lock of the topics held, if the topic is not in memory
+// so the topic is neither loaded nor set while fn runs
+// returns false if the topic is in memory, else the result of fn (true if fn is NULL)
+bool topics_run_if_absent(const char *topic, topics_absent_fn fn, void *user_data);
+
+// evicts all topics, that were not used for idle_s and are evictable (evictable may be NULL)
+// returns the number of evicted topics
+int topics_evict_idle(double idle_s, topics_evictable_fn evictable);
+
+// sets the memory budget (<=0 for unlimited, the default)
+// if the topics use more memory, the least recently used topics are evicted and reloaded on demand
+// evictable is called for each eviction candidate (may be NULL)
+void topics_set_budget(ssize budget_bytes, topics_evictable_fn evictable);
+
+// returns the current memory usage and the hit / miss / eviction counters
+TopicsStats_s topics_stats();
+
+// enables or disables loading topic files in topics_get (enabled by default)
+// if disabled, topics_get only returns topics that are in memory
+void topics_set_loading(bool load_files);
+
+// returns all topics, that are in memory, with a new reference each (unref them and s_free the array!)
+TopicRef_s *topics_collect(ssize *out_size);
+
+// loads all topic files of the topics directory into memory (warm up)
+// the files are decoded in parallel by threads (+ the calling thread)
+// blocks until all topics are loaded, topics that are already in memory are kept
+void topics_preload(int threads);
+
+#endif //HIGHSCORESERVER_TOPICS_H
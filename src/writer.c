@@ -0,0 +1,216 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include "s/s.h"
+#include "persist.h"
+#include "journal.h"
+#include "writer.h"
+
+// max entries that are taken from the queue and applied in a single batch
+#define WRITER_BATCH_SIZE 256
+
+
+typedef struct WriterJob {
+    _Atomic(struct WriterJob *) next;
+    WriterEntry_s entry;
+    WriterDone_s *opt_done;
+} WriterJob_s;
+
+static struct {
+    int queue_depth;
+    writer_apply_fn apply;
+    writer_apply_pack_fn apply_pack;
+
+    atomic_int pending;
+
+    // mpsc queue (intrusive, see Dmitry Vyukov's non intrusive mpsc node based queue)
+    // producers exchange the head, the single consumer pops from the tail
+    _Atomic(WriterJob_s *) head;
+    WriterJob_s *tail;
+    WriterJob_s stub;
+
+    // posted for each submitted job, so the writer can sleep on an empty queue
+    sem_t wakeup;
+} L;
+
+
+static void queue_push(WriterJob_s *job) {
+    atomic_store_explicit(&job->next, NULL, memory_order_relaxed);
+    WriterJob_s *prev = atomic_exchange_explicit(&L.head, job, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, job, memory_order_release);
+}
+
+// returns NULL if the queue is empty or a producer is in the middle of a push
+static WriterJob_s *queue_pop() {
+    WriterJob_s *tail = L.tail;
+    WriterJob_s *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &L.stub) {
+        if (!next)
+            return NULL;
+        L.tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (next) {
+        L.tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&L.head, memory_order_acquire))
+        return NULL;
+
+    // tail is the last job, so put the stub behind it
+    queue_push(&L.stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        L.tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+// applies all jobs of a batch, entries of the same topic are applied together
+// the entries are logged (journal) or persist_commit writes the changed topics (for write through),
+// before the entries are acknowledged
+static void apply_batch(WriterJob_s **jobs, int n) {
+    static HighscoreEntry_s adds[WRITER_BATCH_SIZE];
+    static HighscorePackEntry_s pack_adds[WRITER_BATCH_SIZE];
+    bool applied[WRITER_BATCH_SIZE] = {0};
+
+    // the stages of the batch are passed to the waiting requests
+    metrics_stages_take();
+
+    for (int i = 0; i < n; i++) {
+        if (applied[i])
+            continue;
+        const WriterEntry_s *first = &jobs[i]->entry;
+        int adds_size = 0;
+        for (int j = i; j < n; j++) {
+            const WriterEntry_s *e = &jobs[j]->entry;
+            if (applied[j] || e->is_pack != first->is_pack || strcmp(e->topic, first->topic) != 0)
+                continue;
+            applied[j] = true;
+            if (first->is_pack)
+                pack_adds[adds_size++] = e->pack_entry;
+            else
+                adds[adds_size++] = e->entry;
+        }
+
+        if (first->is_pack)
+            L.apply_pack(first->topic, pack_adds, adds_size);
+        else
+            L.apply(first->topic, adds, adds_size);
+    }
+
+    for (int i = 0; i < n; i++) {
+        journal_add(&jobs[i]->entry);
+    }
+    // with the journal, the log persists the entries and the snapshots write the topic files
+    if (journal_enabled())
+        journal_commit();
+    else
+        persist_commit();
+
+    MetricsStages_s stages = metrics_stages_take();
+    for (int i = 0; i < n; i++) {
+        if (jobs[i]->opt_done) {
+            jobs[i]->opt_done->stages = stages;
+            sem_post(&jobs[i]->opt_done->sem);
+        }
+        s_free(jobs[i]);
+    }
+    atomic_fetch_sub(&L.pending, n);
+}
+
+static void *writer_thread(void *arg) {
+    WriterJob_s *jobs[WRITER_BATCH_SIZE];
+    for (;;) {
+        bool journal = journal_enabled();
+        int timeout_ms = journal ? journal_tick_timeout_ms() : persist_tick_timeout_ms();
+        if (timeout_ms < 0) {
+            sem_wait(&L.wakeup);
+        } else {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += timeout_ms / 1000;
+            until.tv_nsec += (timeout_ms % 1000) * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            if (sem_timedwait(&L.wakeup, &until) != 0 && errno == ETIMEDOUT) {
+                if (journal)
+                    journal_tick();
+                else
+                    persist_tick();
+                continue;
+            }
+        }
+
+        // take all available jobs, each batch is applied at once
+        int n;
+        do {
+            n = 0;
+            WriterJob_s *job;
+            while (n < WRITER_BATCH_SIZE && (job = queue_pop())) {
+                jobs[n++] = job;
+            }
+            if (n > 0)
+                apply_batch(jobs, n);
+        } while (n == WRITER_BATCH_SIZE);
+    }
+    return NULL;
+}
+
+
+//
+// public
+//
+
+bool writer_start(int queue_depth, writer_apply_fn apply, writer_apply_pack_fn apply_pack) {
+    L.queue_depth = queue_depth;
+    L.apply = apply;
+    L.apply_pack = apply_pack;
+    atomic_init(&L.pending, 0);
+    atomic_init(&L.stub.next, NULL);
+    atomic_init(&L.head, &L.stub);
+    L.tail = &L.stub;
+    sem_init(&L.wakeup, 0, 0);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, writer_thread, NULL) != 0) {
+        s_log_error("writer_start failed to create the writer thread");
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+bool writer_submit(WriterEntry_s entry, WriterDone_s *opt_done) {
+    if (atomic_fetch_add(&L.pending, 1) >= L.queue_depth) {
+        atomic_fetch_sub(&L.pending, 1);
+        return false;
+    }
+
+    WriterJob_s *job = s_new(WriterJob_s, 1);
+    job->entry = entry;
+    job->opt_done = opt_done;
+    queue_push(job);
+    sem_post(&L.wakeup);
+    return true;
+}
+
+int writer_pending() {
+    return atomic_load(&L.pending);
+}
+
+void writer_done_init(WriterDone_s *self) {
+    sem_init(&self->sem, 0, 0);
+}
+
+void writer_done_wait(WriterDone_s *self) {
+    while (sem_wait(&self->sem) != 0) {
+        // interrupted by a signal
+    }
+    sem_destroy(&self->sem);
+}
@@ -0,0 +1,57 @@
+#ifndef HIGHSCORESERVER_WRITER_H
+#define HIGHSCORESERVER_WRITER_H
+
+//
+// Single writer, that applies all entries to the topics
+//      connection threads only validate (decode) the entries and submit them
+//      into a lock free multi producer single consumer queue
+//      the writer thread takes all submitted entries in batches
+//      and applies all entries of a topic in a batch with a single topic update
+//
+
+#include <semaphore.h>
+#include "highscore.h"
+#include "metrics.h"
+
+typedef struct {
+    char topic[HIGHSCORE_TOPIC_MAX_LENGTH];
+    bool is_pack;
+
+    // is_pack ? pack_entry : entry
+    HighscoreEntry_s entry;
+    HighscorePackEntry_s pack_entry;
+} WriterEntry_s;
+
+// used to wait until a submitted entry is applied
+typedef struct {
+    sem_t sem;
+
+    // breakdown of the batch, that applied the entry
+    MetricsStages_s stages;
+} WriterDone_s;
+
+// applies all entries of a batch for a single topic
+typedef void (*writer_apply_fn)(const char *topic, const HighscoreEntry_s *adds, int n);
+typedef void (*writer_apply_pack_fn)(const char *topic, const HighscorePackEntry_s *adds, int n);
+
+
+// starts the writer thread
+// queue_depth is the max number of entries that may be submitted and not yet applied
+bool writer_start(int queue_depth, writer_apply_fn apply, writer_apply_pack_fn apply_pack);
+
+// submits an entry to the writer (lock free)
+// if opt_done is not NULL, it must be waited for with writer_done_wait
+// returns false if the queue is full, so the entry was not submitted
+bool writer_submit(WriterEntry_s entry, WriterDone_s *opt_done);
+
+// returns the number of entries that are submitted and not applied yet
+int writer_pending();
+
+
+// initializes a done, to be passed into writer_submit
+void writer_done_init(WriterDone_s *self);
+
+// waits until the submitted entry is applied and kills the done
+void writer_done_wait(WriterDone_s *self);
+
+#endif //HIGHSCORESERVER_WRITER_H